@@ -0,0 +1,135 @@
+#include "DeltaCodec.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+	const size_t MIN_MATCH = 8;   // shortest copy worth encoding
+	const int HASH_BITS = 14;
+
+	inline uint32_t hash8(const char* p)
+	{
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return static_cast<uint32_t>((v * 0x9E3779B97F4A7C15ull) >> (64 - HASH_BITS));
+	}
+
+	void putVarint(std::string& out, uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+			v >>= 7;
+		}
+		out.push_back(static_cast<char>(v));
+	}
+
+	bool getVarint(const std::string& in, size_t& pos, uint64_t& v)
+	{
+		v = 0;
+		for (int shift = 0; pos < in.size() && shift < 64; shift += 7)
+		{
+			uint8_t b = static_cast<uint8_t>(in[pos++]);
+			v |= static_cast<uint64_t>(b & 0x7F) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	void putLiteral(std::string& out, const std::string& target, size_t from, size_t to)
+	{
+		if (to > from)
+		{
+			putVarint(out, (to - from) << 1);
+			out.append(target, from, to - from);
+		}
+	}
+}
+
+std::string DeltaCodec::encode(const std::string& base, const std::string& target)
+{
+	std::string out;
+	out.reserve(target.size() / 4 + 16);
+
+	if (base.size() < MIN_MATCH || target.size() < MIN_MATCH)
+	{
+		putLiteral(out, target, 0, target.size());
+		return out;
+	}
+
+	// Most recent base position for each 8 byte window hash
+	std::vector<int32_t> table(1u << HASH_BITS, -1);
+	for (size_t i = 0; i + MIN_MATCH <= base.size(); ++i)
+		table[hash8(base.data() + i)] = static_cast<int32_t>(i);
+
+	const char* b = base.data();
+	const char* t = target.data();
+	size_t lit = 0;
+	size_t i = 0;
+	while (i + MIN_MATCH <= target.size())
+	{
+		int32_t cand = table[hash8(t + i)];
+		if (cand < 0 || memcmp(b + cand, t + i, MIN_MATCH) != 0)
+		{
+			++i;
+			continue;
+		}
+
+		size_t bp = static_cast<size_t>(cand);
+		size_t len = MIN_MATCH;
+		while (bp + len < base.size() && i + len < target.size() && b[bp + len] == t[i + len])
+			++len;
+
+		// Grow the match back into the pending literal
+		while (i > lit && bp > 0 && b[bp - 1] == t[i - 1])
+		{
+			--i;
+			--bp;
+			++len;
+		}
+
+		putLiteral(out, target, lit, i);
+		putVarint(out, (static_cast<uint64_t>(len) << 1) | 1);
+		putVarint(out, bp);
+
+		i += len;
+		lit = i;
+	}
+
+	putLiteral(out, target, lit, target.size());
+	return out;
+}
+
+bool DeltaCodec::decode(const std::string& base, const std::string& delta, std::string& target)
+{
+	target.clear();
+
+	size_t pos = 0;
+	while (pos < delta.size())
+	{
+		uint64_t hdr;
+		if (!getVarint(delta, pos, hdr))
+			return false;
+
+		uint64_t len = hdr >> 1;
+		if (hdr & 1)
+		{
+			uint64_t off;
+			if (!getVarint(delta, pos, off) || off > base.size() || len > base.size() - off)
+				return false;
+			target.append(base, static_cast<size_t>(off), static_cast<size_t>(len));
+		}
+		else
+		{
+			if (len > delta.size() - pos)
+				return false;
+			target.append(delta, pos, static_cast<size_t>(len));
+			pos += static_cast<size_t>(len);
+		}
+	}
+
+	return true;
+}
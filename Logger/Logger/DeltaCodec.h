@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+// Byte level delta of a payload against a previous one.
+//
+// The delta is a sequence of ops, each starting with a varint header
+// (length << 1 | copy). A copy op is followed by a varint offset into the
+// base; a literal op is followed by length raw bytes.
+namespace DeltaCodec
+{
+	std::string encode(const std::string& base, const std::string& target);
+
+	// false if the delta is corrupt or does not fit the base
+	bool decode(const std::string& base, const std::string& delta, std::string& target);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "configuration.hxx"
+
+#include <string>
+#include <vector>
+
+// A server the outbox is shipped to. FtpUpload's own Host/path/username/
+// password describe one named "default"; each Destination child adds another.
+// A file is deleted once every required destination holds it.
+struct Destination
+{
+	std::string name;
+	std::string host;
+	uint16_t port{22};
+	std::string path;
+	std::string username;
+	std::string password;
+	std::string keyfile;
+	bool required{true};
+
+	static std::vector<Destination> fromConfig(const loggercfg::FtpUpload& cfg)
+	{
+		std::vector<Destination> r;
+
+		if (cfg.Host_present())
+			r.push_back(Destination{ "default", cfg.Host(), cfg.Port(),
+				cfg.path_present() ? cfg.path() : std::string(),
+				cfg.username_present() ? cfg.username() : std::string(),
+				cfg.password_present() ? cfg.password() : std::string(),
+				cfg.keyfile_present() ? cfg.keyfile() : std::string(), true });
+
+		for (const loggercfg::destination_t& d : cfg.Destination())
+			r.push_back(Destination{ d.Name(), d.Host(), d.Port(), d.path(), d.username(),
+				d.password_present() ? d.password() : std::string(),
+				d.keyfile_present() ? d.keyfile() : std::string(), d.Required() });
+
+		return r;
+	}
+};
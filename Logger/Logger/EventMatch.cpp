@@ -0,0 +1,67 @@
+#include "EventMatch.h"
+#include "pugixml/pugixml.hpp"
+
+#include <regex>
+
+bool EventMatch::subject(const loggercfg::event_string_t& ev, const PubSub::Subject& s)
+{
+	return PubSub::match(PubSub::parseSubject(ev), s);
+}
+
+bool EventMatch::payload(const loggercfg::event_string_t& ev, const std::string& payload, std::string& error)
+{
+	pugi::xpath_value_type xPathType = pugi::xpath_type_string;
+	bool found = true;
+	std::string foundText;
+
+	if (ev.xpath_present())
+	{
+		pugi::xml_document doc;
+		pugi::xml_parse_result r = doc.load_string(payload.c_str());
+		if (r.status != pugi::xml_parse_status::status_ok)
+		{
+			error = "Payload for event " + ev + " not valid XML";
+			return false;
+		}
+
+		try
+		{
+			pugi::xpath_query xp(ev.xpath().c_str());
+			xPathType = xp.return_type();
+			switch (xPathType)
+			{
+			case pugi::xpath_type_node_set:
+				found = !xp.evaluate_node_set(doc).empty();
+				break;
+			case pugi::xpath_type_number:
+				found = xp.evaluate_number(doc) != 0.0;
+				break;
+			case pugi::xpath_type_string:
+				foundText = xp.evaluate_string(doc);
+				found = !foundText.empty();
+				break;
+			case pugi::xpath_type_boolean:
+				found = xp.evaluate_boolean(doc);
+				break;
+			case pugi::xpath_type_none:// Unknown type (query failed to compile)
+			default:
+				error = "Xpath for event " + ev + " not valid";
+				found = false;
+				break;
+			}
+		}
+		catch (const pugi::xpath_exception& ex)
+		{
+			error = ex.result().description();
+			return 1;
+		}
+	}
+
+	if (ev.regex_present() && found && xPathType == pugi::xpath_type_string)
+	{
+		std::regex rg(ev.regex());
+		found = std::regex_search(ev.xpath_present() ? foundText : payload, rg);
+	}
+
+	return found;
+}
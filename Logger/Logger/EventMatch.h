@@ -0,0 +1,18 @@
+#pragma once
+
+#include "HubApp/HubApp.h"
+#include "configuration.hxx"
+
+#include <string>
+
+// Evaluation of the <Event> triggers under NewFile, Flush and FtpUpload. An
+// event matches when its subject pattern matches and the payload satisfies
+// its xpath and regex, if given. A string xpath result is what the regex is
+// searched in; otherwise the regex applies to the whole payload.
+namespace EventMatch
+{
+	bool subject(const loggercfg::event_string_t& ev, const PubSub::Subject& s);
+
+	// error is set when the payload or the xpath cannot be evaluated
+	bool payload(const loggercfg::event_string_t& ev, const std::string& payload, std::string& error);
+}
@@ -0,0 +1,319 @@
+#include "Exporter.h"
+#include "Metrics.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+namespace Logging
+{
+	const uint32_t LC_Export = 0x2000;
+	template <> const char* getLCStr<LC_Export   >() { return "Export  "; }
+}
+
+using namespace Logging;
+
+namespace
+{
+	const char* PREFIX = "ccmlogger_";
+
+	// A scraper that connects and says nothing is dropped after this long
+	const auto REQUEST_TIMEOUT = std::chrono::seconds(5);
+
+	// Largest request header read before answering anyway
+	const size_t MAX_REQUEST = 8192;
+
+	// Histogram buckets, as powers of two microseconds: 16us .. 64s. Each is
+	// published up to the largest value sharing a Histogram bucket with the
+	// power of two, the nearest bound that le's "at most" can be exact for
+	const unsigned FIRST_BUCKET = 4;
+	const unsigned LAST_BUCKET = 26;
+
+	// Microseconds as exact decimal seconds
+	std::string seconds(uint64_t us)
+	{
+		char s[32];
+		snprintf(s, sizeof(s), "%llu.%06llu", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000));
+		return s;
+	}
+
+	// "BytesReceived" -> "bytes_received"
+	std::string snake(const char* name)
+	{
+		std::string r;
+		for (const char* p = name; *p; ++p)
+		{
+			if (isupper((unsigned char)*p))
+			{
+				if (p != name)
+					r += '_';
+				r += char(tolower((unsigned char)*p));
+			}
+			else
+				r += *p;
+		}
+		return r;
+	}
+
+	bool endsWith(const std::string& s, const char* suffix)
+	{
+		size_t n = strlen(suffix);
+		return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+	}
+
+	// Reads whatever request arrives, answers it with the metrics and closes
+	template <typename Socket>
+	class Connection : public std::enable_shared_from_this<Connection<Socket>>
+	{
+		const Exporter& m_exporter;
+		Socket m_sock;
+		boost::asio::steady_timer m_timer;
+		boost::asio::streambuf m_request{MAX_REQUEST};
+		std::string m_response;
+
+	public:
+		Connection(const Exporter& exporter, Socket&& sock)
+			: m_exporter(exporter), m_sock(std::move(sock)), m_timer(m_sock.get_executor())
+		{
+		}
+
+		static void serve(const Exporter& exporter, Socket&& sock)
+		{
+			std::make_shared<Connection>(exporter, std::move(sock))->read();
+		}
+
+	private:
+		void read()
+		{
+			auto self = this->shared_from_this();
+			m_timer.expires_after(REQUEST_TIMEOUT);
+			m_timer.async_wait([self](const boost::system::error_code& ec) {
+				if (!ec)
+				{
+					boost::system::error_code ignored;
+					self->m_sock.close(ignored);
+				}
+			});
+			boost::asio::async_read_until(m_sock, m_request, "\r\n\r\n",
+				[self](const boost::system::error_code& ec, size_t) {
+					// A full buffer still gets an answer; anything else was a hang up or timeout
+					if (!ec || ec == boost::asio::error::not_found)
+						self->write();
+					else
+						self->m_timer.cancel();
+				});
+		}
+
+		void write()
+		{
+			std::string body = m_exporter.render();
+			std::ostringstream strm;
+			strm << "HTTP/1.0 200 OK\r\n"
+				<< "Content-Type: text/plain; version=0.0.4\r\n"
+				<< "Content-Length: " << body.size() << "\r\n"
+				<< "Connection: close\r\n\r\n"
+				<< body;
+			m_response = strm.str();
+
+			auto self = this->shared_from_this();
+			boost::asio::async_write(m_sock, boost::asio::buffer(m_response),
+				[self](const boost::system::error_code&, size_t) {
+					boost::system::error_code ignored;
+					self->m_sock.shutdown(Socket::shutdown_both, ignored);
+					self->m_sock.close(ignored);
+					self->m_timer.cancel();
+				});
+		}
+	};
+}
+
+Exporter::Exporter(Logging::LogFile& log, const loggercfg::Exporter& cfg, std::function<std::vector<Value>()> values)
+	: Logging::LogClient(log)
+	, m_values(std::move(values))
+	, m_socketPath(cfg.Socket_present() ? cfg.Socket() : std::string())
+	, m_filePath(cfg.File_present() ? cfg.File() : std::string())
+	, m_interval(std::max(1u, cfg.IntervalS()))
+	, m_tcp(m_io)
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	, m_local(m_io)
+#endif
+	, m_fileTimer(m_io)
+{
+	boost::system::error_code ec;
+
+	if (cfg.Port_present())
+	{
+		boost::asio::ip::tcp::endpoint ep(boost::asio::ip::address_v4::loopback(), cfg.Port());
+		m_tcp.open(ep.protocol(), ec);
+		if (!ec)
+			m_tcp.set_option(boost::asio::socket_base::reuse_address(true), ec);
+		if (!ec)
+			m_tcp.bind(ep, ec);
+		if (!ec)
+			m_tcp.listen(boost::asio::socket_base::max_listen_connections, ec);
+		if (ec)
+		{
+			LOG(LL_Warning, LC_Export, "Cannot listen on 127.0.0.1:" << cfg.Port() << ": " << ec.message());
+			m_tcp.close(ec);
+		}
+		else
+		{
+			LOG(LL_Info, LC_Export, "Serving metrics on 127.0.0.1:" << cfg.Port());
+			acceptTcp();
+		}
+	}
+
+	if (!m_socketPath.empty())
+	{
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+		// A socket left behind by an unclean exit would fail the bind
+		::remove(m_socketPath.c_str());
+
+		boost::asio::local::stream_protocol::endpoint ep(m_socketPath);
+		m_local.open(ep.protocol(), ec);
+		if (!ec)
+			m_local.bind(ep, ec);
+		if (!ec)
+			m_local.listen(boost::asio::socket_base::max_listen_connections, ec);
+		if (ec)
+		{
+			LOG(LL_Warning, LC_Export, "Cannot listen on " << m_socketPath << ": " << ec.message());
+			m_local.close(ec);
+			m_socketPath.clear();
+		}
+		else
+		{
+			LOG(LL_Info, LC_Export, "Serving metrics on " << m_socketPath);
+			acceptLocal();
+		}
+#else
+		LOG(LL_Warning, LC_Export, "Unix domain sockets are not supported here; Exporter/@Socket ignored");
+		m_socketPath.clear();
+#endif
+	}
+
+	if (!m_filePath.empty())
+	{
+		LOG(LL_Info, LC_Export, "Writing metrics to " << m_filePath << " every " << m_interval.count() << "s");
+		writeFile();
+	}
+
+	m_thread = std::thread([this]() {
+		Profiler::tag(Profiler::RoleExporter);
+		m_io.run();
+	});
+}
+
+Exporter::~Exporter()
+{
+	m_io.stop();
+	if (m_thread.joinable())
+		m_thread.join();
+
+	if (!m_socketPath.empty())
+		::remove(m_socketPath.c_str());
+}
+
+void Exporter::acceptTcp()
+{
+	m_tcp.async_accept([this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket sock) {
+		if (ec == boost::asio::error::operation_aborted)
+			return;
+		if (!ec)
+			Connection<boost::asio::ip::tcp::socket>::serve(*this, std::move(sock));
+		acceptTcp();
+	});
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+void Exporter::acceptLocal()
+{
+	m_local.async_accept([this](const boost::system::error_code& ec, boost::asio::local::stream_protocol::socket sock) {
+		if (ec == boost::asio::error::operation_aborted)
+			return;
+		if (!ec)
+			Connection<boost::asio::local::stream_protocol::socket>::serve(*this, std::move(sock));
+		acceptLocal();
+	});
+}
+#endif
+
+// Written aside and renamed over, so a collector never reads half a file
+void Exporter::writeFile()
+{
+	std::string tmp = m_filePath + ".tmp";
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		f << render();
+		if (!f)
+			LOG(LL_Warning, LC_Export, "Cannot write " << tmp);
+	}
+
+	boost::system::error_code ec;
+	BF::rename(tmp, m_filePath, ec);
+	if (ec)
+		LOG(LL_Warning, LC_Export, "Cannot rename " << tmp << " to " << m_filePath << ": " << ec.message());
+
+	m_fileTimer.expires_after(m_interval);
+	m_fileTimer.async_wait([this](const boost::system::error_code& ec) {
+		if (!ec)
+			writeFile();
+	});
+}
+
+std::string Exporter::render() const
+{
+	std::ostringstream strm;
+	strm << std::setprecision(15);
+
+	// Counters ending in Us are durations, exported in seconds as is the convention
+	Metrics::Snapshot counters = Metrics::snapshot();
+	for (size_t c = 0; c < Metrics::COUNTERS; ++c)
+	{
+		std::string name = PREFIX + snake(Metrics::name(Metrics::Counter(c)));
+		bool us = endsWith(name, "_us");
+		if (us)
+			name.replace(name.size() - 3, 3, "_seconds");
+		name += "_total";
+
+		strm << "# TYPE " << name << " counter\n" << name << " ";
+		if (us)
+			strm << counters.v[c] / 1e6 << "\n";
+		else
+			strm << counters.v[c] << "\n";
+	}
+
+	for (const Value& v : m_values())
+	{
+		std::string name = std::string(PREFIX) + v.name;
+		strm << "# HELP " << name << " " << v.help << "\n"
+			<< "# TYPE " << name << (v.counter ? " counter\n" : " gauge\n")
+			<< name << " " << v.value << "\n";
+	}
+
+	const char* name = "ccmlogger_latency_seconds";
+	strm << "# HELP " << name << " Time a message spends in each stage from publish to the file\n"
+		<< "# TYPE " << name << " histogram\n";
+	for (size_t s = 0; s < Metrics::STAGES; ++s)
+	{
+		Histogram::Snapshot h = Metrics::latency(Metrics::Stage(s)).snapshot();
+		std::string stage = std::string("stage=\"") + Metrics::name(Metrics::Stage(s)) + "\"";
+
+		for (unsigned b = FIRST_BUCKET; b <= LAST_BUCKET; ++b)
+		{
+			uint64_t le = Histogram::upper(Histogram::index(uint64_t(1) << b));
+			strm << name << "_bucket{" << stage << ",le=\"" << seconds(le) << "\"} " << h.atMost(le) << "\n";
+		}
+		strm << name << "_bucket{" << stage << ",le=\"+Inf\"} " << h.count() << "\n"
+			<< name << "_sum{" << stage << "} " << h.sum / 1e6 << "\n"
+			<< name << "_count{" << stage << "} " << h.count() << "\n";
+	}
+
+	return strm.str();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Logging/Log.h"
+#include "configuration.hxx"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serves the metrics in Prometheus text format for local scrapers, on its own
+// thread so a scrape never touches the message path: counters and histograms
+// are read from their atomics, values owned elsewhere through the callback. Any of
+//   Socket     HTTP on a Unix domain socket at this path
+//   Port       HTTP on 127.0.0.1:Port
+//   File       rewritten every IntervalS seconds via a rename, for textfile collectors
+// may be configured. Every request is answered with the metrics and closed.
+class Exporter : public Logging::LogClient
+{
+public:
+	struct Value
+	{
+		const char* name;
+		const char* help;
+		double value;
+		bool counter;
+	};
+
+	Exporter(Logging::LogFile& log, const loggercfg::Exporter& cfg, std::function<std::vector<Value>()> values);
+	~Exporter();
+
+	// The whole exposition, as served
+	std::string render() const;
+
+private:
+	void acceptTcp();
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	void acceptLocal();
+#endif
+	void writeFile();
+
+	std::function<std::vector<Value>()> m_values;
+	std::string m_socketPath;
+	std::string m_filePath;
+	std::chrono::seconds m_interval;
+
+	boost::asio::io_context m_io;
+	boost::asio::ip::tcp::acceptor m_tcp;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	boost::asio::local::stream_protocol::acceptor m_local;
+#endif
+	boost::asio::steady_timer m_fileTimer;
+	std::thread m_thread;
+};
@@ -0,0 +1,144 @@
+#include "FastClock.h"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <time.h>
+
+namespace
+{
+	// The TSC keeps time only if it runs at a constant rate through frequency
+	// changes and on through deep C-states; the kernel reports both
+	bool counterUsable()
+	{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__linux__)
+		std::ifstream in("/proc/cpuinfo");
+		std::string line;
+		while (std::getline(in, line))
+		{
+			if (line.compare(0, 5, "flags") != 0)
+				continue;
+
+			std::istringstream strm(line);
+			std::string flag;
+			bool constant = false, nonstop = false;
+			while (strm >> flag)
+			{
+				constant = constant || flag == "constant_tsc";
+				nonstop = nonstop || flag == "nonstop_tsc";
+			}
+			return constant && nonstop;
+		}
+		return false;
+#elif defined(__aarch64__)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	std::chrono::nanoseconds coarseResolution()
+	{
+#if defined(__linux__)
+		timespec ts;
+		if (clock_getres(CLOCK_MONOTONIC_COARSE, &ts) == 0)
+			return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#endif
+		return std::chrono::nanoseconds::max();
+	}
+}
+
+std::chrono::steady_clock::time_point FastClock::coarse()
+{
+#if defined(__linux__)
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+#else
+	return std::chrono::steady_clock::now();
+#endif
+}
+
+void FastClock::sample(uint64_t& t, std::chrono::steady_clock::time_point& at) const
+{
+	// Bracketed, so a preemption between the reads can be retried
+	for (int tries = 0;; ++tries)
+	{
+		uint64_t before = ticks();
+		at = std::chrono::steady_clock::now();
+		uint64_t after = ticks();
+		t = before + (after - before) / 2;
+		if (double(after - before) * m_nsPerTick < 1000.0 || tries == 4)
+			return;
+	}
+}
+
+void FastClock::configure(const std::string& name, std::chrono::nanoseconds resolution)
+{
+	bool coarseOk = coarseResolution() <= resolution;
+	bool counterOk = counterUsable();
+
+	if (name == "steady")
+		m_source = Steady;
+	else if (name == "coarse")
+		m_source = coarseOk ? Coarse : Steady;
+	else if (name == "counter")
+		m_source = counterOk ? Counter : Steady;
+	else
+		m_source = coarseOk ? Coarse : counterOk ? Counter : Steady;
+
+	if (m_source != Counter)
+		return;
+
+	// The counter's rate: architectural on AArch64, measured on x86
+	m_nsPerTick = 1.0;
+	sample(m_calTicks, m_calTime);
+#if defined(__aarch64__)
+	uint64_t freq;
+	asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+	m_nsPerTick = 1e9 / double(freq);
+#else
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	uint64_t t;
+	std::chrono::steady_clock::time_point at;
+	sample(t, at);
+	m_nsPerTick = double(std::chrono::duration_cast<std::chrono::nanoseconds>(at - m_calTime).count()) / double(t - m_calTicks);
+	m_calTicks = t;
+	m_calTime = at;
+#endif
+	m_baseTicks = m_calTicks;
+	m_baseTime = m_calTime;
+}
+
+void FastClock::recalibrate()
+{
+	if (m_source != Counter)
+		return;
+
+	uint64_t t;
+	std::chrono::steady_clock::time_point at;
+	sample(t, at);
+	if (at - m_calTime >= std::chrono::seconds(1) && t > m_calTicks)
+	{
+		m_nsPerTick = double(std::chrono::duration_cast<std::chrono::nanoseconds>(at - m_calTime).count()) / double(t - m_calTicks);
+		m_calTicks = t;
+		m_calTime = at;
+	}
+
+	m_baseTicks = t;
+	m_baseTime = at;
+}
+
+const char* FastClock::name() const
+{
+	switch (m_source)
+	{
+	case Counter:
+		return "counter";
+	case Coarse:
+		return "coarse";
+	default:
+		return "steady";
+	}
+}
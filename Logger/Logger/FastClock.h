@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// steady_clock time from the cheapest source that is good enough, for the
+// record timestamps taken on every write:
+//   counter  the TSC on x86 when the CPU keeps it invariant, CNTVCT_EL0 on
+//            AArch64. A register read, scaled by a rate calibrated against
+//            steady_clock and refined by recalibrate()
+//   coarse   CLOCK_MONOTONIC_COARSE, which skips the hardware read but only
+//            advances every scheduler tick, so only chosen when that tick is
+//            within the resolution asked for
+//   steady   steady_clock itself
+// Times are on steady_clock's epoch, so they mix with steady_clock::now().
+// Not thread safe; each writer keeps its own.
+class FastClock
+{
+public:
+	enum Source
+	{
+		Steady,
+		Coarse,
+		Counter
+	};
+
+	// Picks a source for name ("auto", "counter", "coarse" or "steady") that
+	// keeps resolution, falling back to steady when the choice is unusable.
+	// Calibrating the counter takes a few ms
+	void configure(const std::string& name, std::chrono::nanoseconds resolution);
+
+	std::chrono::steady_clock::time_point now() const
+	{
+		if (m_source == Counter)
+			return m_baseTime + std::chrono::nanoseconds(int64_t(double(ticks() - m_baseTicks) * m_nsPerTick));
+		if (m_source == Coarse)
+			return coarse();
+		return std::chrono::steady_clock::now();
+	}
+
+	// Restarts the counter's scale from now, with the rate measured since the
+	// last call, so drift from the initial calibration does not accumulate.
+	// Cheap; call every few seconds or more
+	void recalibrate();
+
+	Source source() const { return m_source; }
+	const char* name() const;
+
+private:
+	static uint64_t ticks()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#elif defined(__aarch64__)
+		uint64_t t;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+		return t;
+#else
+		return 0;
+#endif
+	}
+
+	static std::chrono::steady_clock::time_point coarse();
+
+	// A tick count and the steady_clock time it corresponds to
+	void sample(uint64_t& t, std::chrono::steady_clock::time_point& at) const;
+
+	Source m_source{Steady};
+	uint64_t m_baseTicks{0};
+	std::chrono::steady_clock::time_point m_baseTime;
+	double m_nsPerTick{1.0};
+
+	// Where the current rate was measured from
+	uint64_t m_calTicks{0};
+	std::chrono::steady_clock::time_point m_calTime;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// HDR style log-linear histogram of non-negative integers, typically
+// microseconds. Each power of two is split into SUB linear buckets, so any
+// value is held to within 1/SUB (about 6%) over the whole 64 bit range in a
+// fixed 8 KB. Recording is a few relaxed atomic operations and never locks;
+// readers take a snapshot and work from that.
+class Histogram
+{
+public:
+	static constexpr unsigned SUB_BITS = 4;
+	static constexpr uint64_t SUB = 1u << SUB_BITS;
+	static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+	void record(uint64_t v, uint64_t n = 1)
+	{
+		m_counts[index(v)].fetch_add(n, std::memory_order_relaxed);
+		m_sum.fetch_add(v * n, std::memory_order_relaxed);
+
+		uint64_t m = m_max.load(std::memory_order_relaxed);
+		while (v > m && !m_max.compare_exchange_weak(m, v, std::memory_order_relaxed))
+			;
+	}
+
+	struct Snapshot
+	{
+		std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS);
+		uint64_t max{0};
+		uint64_t sum{0};
+
+		uint64_t count() const
+		{
+			uint64_t n = 0;
+			for (uint64_t c : counts)
+				n += c;
+			return n;
+		}
+
+		// Upper bound of the bucket holding the p'th fraction of samples, 0 <= p <= 1
+		uint64_t percentile(double p) const
+		{
+			uint64_t total = count();
+			if (!total)
+				return 0;
+
+			uint64_t rank = std::max<uint64_t>(1, uint64_t(p * total + 0.5));
+			uint64_t seen = 0;
+			for (size_t i = 0; i < BUCKETS; ++i)
+			{
+				seen += counts[i];
+				if (seen >= rank)
+					return std::min(upper(i), max);
+			}
+			return max;
+		}
+
+		// Samples below v; exact when v is a power of two
+		uint64_t below(uint64_t v) const
+		{
+			uint64_t n = 0;
+			for (size_t i = 0; i < index(v); ++i)
+				n += counts[i];
+			return n;
+		}
+
+		// Samples at most v; exact when v is the upper() of its bucket
+		uint64_t atMost(uint64_t v) const
+		{
+			return below(v) + counts[index(v)];
+		}
+
+		// Samples recorded after earlier was taken. The maximum is only
+		// known to bucket precision
+		Snapshot since(const Snapshot& earlier) const
+		{
+			Snapshot r;
+			for (size_t i = 0; i < BUCKETS; ++i)
+			{
+				r.counts[i] = counts[i] - earlier.counts[i];
+				if (r.counts[i])
+					r.max = std::min(upper(i), max);
+			}
+			r.sum = sum - earlier.sum;
+			return r;
+		}
+	};
+
+	Snapshot snapshot() const
+	{
+		Snapshot r;
+		for (size_t i = 0; i < BUCKETS; ++i)
+			r.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+		r.max = m_max.load(std::memory_order_relaxed);
+		r.sum = m_sum.load(std::memory_order_relaxed);
+		return r;
+	}
+
+	static size_t index(uint64_t v)
+	{
+		if (v < SUB)
+			return size_t(v);
+
+		unsigned e = msb(v);
+		return size_t((e - SUB_BITS + 1) * SUB + ((v >> (e - SUB_BITS)) & (SUB - 1)));
+	}
+
+	// Largest value that lands in bucket i
+	static uint64_t upper(size_t i)
+	{
+		if (i < SUB)
+			return i;
+
+		unsigned shift = unsigned(i / SUB) - 1;
+		uint64_t lower = (SUB + i % SUB) << shift;
+		return lower + ((uint64_t(1) << shift) - 1);
+	}
+
+private:
+	static unsigned msb(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long e;
+		_BitScanReverse64(&e, v);
+		return unsigned(e);
+#else
+		return 63 - unsigned(__builtin_clzll(v));
+#endif
+	}
+
+	std::atomic<uint64_t> m_counts[BUCKETS] {};
+	std::atomic<uint64_t> m_max{0};
+	std::atomic<uint64_t> m_sum{0};
+};
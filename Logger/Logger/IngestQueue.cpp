@@ -0,0 +1,176 @@
+#include "IngestQueue.h"
+
+#include <algorithm>
+
+void IngestQueue::configure(const loggercfg::Logger& cfg)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	m_priorities.clear();
+	if (!cfg.Queue_present())
+		return;
+
+	const loggercfg::Queue& q = cfg.Queue();
+	m_maxCount = std::max(1u, q.MaxCount());
+	m_maxBytes = q.MaxBytes();
+	m_blockTime = std::chrono::milliseconds(q.BlockMs());
+
+	const std::string& o = q.Overload();
+	if (o == "dropnewest")
+		m_overload = Overload::DropNewest;
+	else if (o == "dropoldest")
+		m_overload = Overload::DropOldest;
+	else if (o == "priority")
+		m_overload = Overload::Priority;
+	else
+		m_overload = Overload::Block;
+
+	for (const loggercfg::priority_t& p : q.Priority())
+		m_priorities.emplace_back(PubSub::parseSubject(p.Subject()), p.Level());
+}
+
+uint32_t IngestQueue::priority(const PubSub::Subject& s) const
+{
+	for (const auto& p : m_priorities)
+		if (PubSub::match(p.first, s))
+			return p.second;
+
+	return 0;
+}
+
+void IngestQueue::dropped(size_t bytes)
+{
+	++m_gapMsgs;
+	m_gapBytes += bytes;
+	m_gapPending.store(true, std::memory_order_relaxed);
+	m_droppedMsgs.fetch_add(1, std::memory_order_relaxed);
+	m_droppedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+IngestQueue::Levels::iterator IngestQueue::oldest()
+{
+	auto o = m_levels.begin();
+	for (auto it = std::next(o); it != m_levels.end(); ++it)
+		if (it->second.front().seq < o->second.front().seq)
+			o = it;
+	return o;
+}
+
+void IngestQueue::remove(Levels::iterator level, Entry* e)
+{
+	Entry& f = level->second.front();
+	m_bytes -= f.bytes;
+	--m_count;
+
+	if (e)
+		*e = std::move(f);
+	else
+		dropped(f.bytes);
+
+	level->second.pop_front();
+	if (level->second.empty())
+		m_levels.erase(level);
+}
+
+bool IngestQueue::push(PubSub::Message&& m)
+{
+	Entry e;
+	e.received = clock::now();
+	e.bytes = sizeof(Entry) + m.payload.size() + m.postmarks.size() * sizeof(uint32_t);
+	for (const std::string& s : m.subject)
+		e.bytes += s.size() + sizeof(std::string);
+
+	std::unique_lock<std::mutex> s(m_lk);
+
+	if (m_closed)
+		return false;
+
+	if (full(e.bytes))
+	{
+		switch (m_overload)
+		{
+		case Overload::Block:
+			if (!m_space.wait_for(s, m_blockTime, [&]() { return m_closed || !full(e.bytes); }) || m_closed)
+			{
+				dropped(e.bytes);
+				return false;
+			}
+			break;
+		case Overload::DropNewest:
+			dropped(e.bytes);
+			return false;
+		case Overload::DropOldest:
+			while (full(e.bytes))
+				remove(oldest(), nullptr);
+			break;
+		case Overload::Priority:
+			e.priority = priority(m.subject);
+			while (full(e.bytes))
+			{
+				auto lowest = m_levels.begin();
+				if (lowest->first >= e.priority)
+				{
+					dropped(e.bytes);
+					return false;
+				}
+				remove(lowest, nullptr);
+			}
+			break;
+		}
+	}
+
+	bool wasEmpty = m_count == 0;
+
+	e.msg = std::move(m);
+	e.seq = m_seq++;
+	m_bytes += e.bytes;
+	++m_count;
+	m_levels[e.priority].push_back(std::move(e));
+
+	m_depth.store(m_count, std::memory_order_relaxed);
+	m_bytesQueued.store(m_bytes, std::memory_order_relaxed);
+	return wasEmpty;
+}
+
+bool IngestQueue::pop(Entry& e)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	if (!m_count)
+		return false;
+
+	remove(oldest(), &e);
+
+	m_depth.store(m_count, std::memory_order_relaxed);
+	m_bytesQueued.store(m_bytes, std::memory_order_relaxed);
+
+	s.unlock();
+	m_space.notify_one();
+	return true;
+}
+
+bool IngestQueue::takeGap(uint64_t& msgs, uint64_t& bytes)
+{
+	if (!m_gapPending.load(std::memory_order_relaxed))
+		return false;
+
+	std::unique_lock<std::mutex> s(m_lk);
+
+	m_gapPending.store(false, std::memory_order_relaxed);
+	if (!m_gapMsgs)
+		return false;
+
+	msgs = m_gapMsgs;
+	bytes = m_gapBytes;
+	m_gapMsgs = m_gapBytes = 0;
+	return true;
+}
+
+void IngestQueue::close()
+{
+	{
+		std::unique_lock<std::mutex> s(m_lk);
+		m_closed = true;
+	}
+	m_space.notify_all();
+}
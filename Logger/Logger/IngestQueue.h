@@ -0,0 +1,91 @@
+#pragma once
+
+#include "HubApp/HubApp.h"
+#include "configuration.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Bounded hand off between the hub handler and the record writer, limited by
+// message count and approximate memory. When full the <Queue> Overload policy
+// decides what is lost:
+//   block      - the hub handler waits up to BlockMs for space, then drops the new message
+//   dropnewest - the new message is dropped
+//   dropoldest - the oldest queued message is dropped
+//   priority   - the lowest <Priority> message is dropped, oldest first.
+//                The new message is dropped if nothing queued is lower
+// Each priority level has its own FIFO so dropping is O(1); pop() takes the
+// oldest front across the levels, keeping arrival order.
+class IngestQueue
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	enum class Overload { Block, DropNewest, DropOldest, Priority };
+
+	struct Entry
+	{
+		PubSub::Message msg;
+		clock::time_point received;
+		size_t bytes{0};
+		uint32_t priority{0};
+		uint64_t seq{0};  // arrival order across priority levels
+	};
+
+	void configure(const loggercfg::Logger& cfg);
+
+	// true if the queue was empty, i.e. the caller needs to schedule a drain
+	bool push(PubSub::Message&& m);
+
+	// false if empty
+	bool pop(Entry& e);
+
+	// Messages and bytes dropped since the last call. false if none
+	bool takeGap(uint64_t& msgs, uint64_t& bytes);
+
+	// Release any blocked producers, nothing more is accepted
+	void close();
+
+	size_t depth() const { return m_depth.load(std::memory_order_relaxed); }
+	size_t bytes() const { return m_bytesQueued.load(std::memory_order_relaxed); }
+	uint64_t droppedMsgs() const { return m_droppedMsgs.load(std::memory_order_relaxed); }
+	uint64_t droppedBytes() const { return m_droppedBytes.load(std::memory_order_relaxed); }
+
+private:
+	uint32_t priority(const PubSub::Subject& s) const;
+	bool full(size_t extra) const { return m_count && (m_count >= m_maxCount || m_bytes + extra > m_maxBytes); }
+	void dropped(size_t bytes);
+
+	typedef std::map<uint32_t, std::deque<Entry>> Levels;
+	Levels::iterator oldest();
+	void remove(Levels::iterator level, Entry* e);
+
+	mutable std::mutex m_lk;
+	std::condition_variable m_space;
+	Levels m_levels;  // by priority, each oldest first
+	size_t m_count{0};
+	size_t m_bytes{0};
+	uint64_t m_seq{0};
+	bool m_closed{false};
+
+	size_t m_maxCount{100000};
+	size_t m_maxBytes{64u << 20};
+	Overload m_overload{Overload::Block};
+	std::chrono::milliseconds m_blockTime{1000};
+	std::vector<std::pair<PubSub::Subject, uint32_t>> m_priorities;
+
+	uint64_t m_gapMsgs{0};
+	uint64_t m_gapBytes{0};
+	std::atomic<bool> m_gapPending{false};
+
+	std::atomic<size_t> m_depth{0};
+	std::atomic<size_t> m_bytesQueued{0};
+	std::atomic<uint64_t> m_droppedMsgs{0};
+	std::atomic<uint64_t> m_droppedBytes{0};
+};
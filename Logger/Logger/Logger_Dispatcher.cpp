@@ -1,10 +1,13 @@
-#define fopen_s(FD, FPATH, FLAGS) *FD = fopen(FPATH, FLAGS);
-
 #include "Logger_Dispatcher.h"
 #include "configuration-pimpl.hxx"
 #include "syscfg-pimpl.hxx"
 #include "PSubLocal.h"
-#include "pugixml/pugixml.hpp"
+#include "Uploader.h"
+#include "Exporter.h"
+#include "EventMatch.h"
+#include "TraceRing.h"
+#include "Profiler.h"
+#include "XmlEscape.h"
 
 #include <stdint.h>
 
@@ -12,7 +15,7 @@
 #include <sstream>
 #include <set>
 #include <cstdio>
-#include <regex>
+#include <iomanip>
 
 namespace Logging
 {
@@ -28,6 +31,13 @@ const PubSub::Subject SUB_SHARED_CFG{ "CFG", "Shared" };
 
 const PubSub::Subject SUB_NEW_FILE{ "Logger", "Newfile" };
 const PubSub::Subject SUB_FLUSH_FILE{ "Logger", "Flush" };
+const PubSub::Subject SUB_DUMP{ "Logger", "Dump" };
+const PubSub::Subject SUB_PROFILE{ "Logger", "Profile" };
+
+const PubSub::Subject SUB_UPLOAD_STATUS{ "Status", "Logger", "Upload" };
+const PubSub::Subject SUB_METRICS{ "Status", "Logger", "Metrics" };
+const PubSub::Subject SUB_PROFILE_STATUS{ "Status", "Logger", "Profile" };
+const PubSub::Subject SUB_TOPK{ "Status", "Logger", "TopK" };
 
 
 #if defined(_DEBUG) && defined(WIN32)
@@ -56,8 +66,13 @@ Logger_Dispatcher::~Logger_Dispatcher()
 	{
 		LOG(LL_Debug, LC_Logger, "stop");
 
+		m_metricsMsg.reset();
+		m_topKMsg.reset();
+		m_exporter.reset();
+		m_profiler.reset();
 		getMsgDispatcher().stop();
 		m_hub.stop();
+		logLatency();
 	}
 	catch (const std::exception& ex)
 	{
@@ -80,10 +95,51 @@ void Logger_Dispatcher::configure(const std::string& cfgStr)
 		{
 			d.parse(cfgstrm);
 			std::unique_ptr<loggercfg::Logger>{s.post()}->_copy(m_cfg);
+			Trace::setDumpDir(m_cfg.LogPath());
 
 			m_local.reset(new PSubLocal(getMsgDispatcher(), m_log, m_hub, m_cfg, [this](){ enqueue<evNewFileCreated>(); } ));
 			m_local->start();
 
+			if (m_cfg.FtpUpload_present())
+			{
+				// One shaper for all destinations, so RateBps bounds their total
+				m_shaper.reset(new Shaper(m_log));
+				m_shaper->configure(m_cfg.FtpUpload());
+				for (const Destination& dest : Destination::fromConfig(m_cfg.FtpUpload()))
+				{
+					m_uploaders.emplace_back(new Uploader(m_log, m_cfg, dest, *m_local->outbox(), *m_shaper,
+						[this](std::string& fname, uint64_t& offset) { return m_local->liveBoundary(fname, offset); },
+						[this](const std::string& s) { m_hub.sendMsg(PubSub::Message{SUB_UPLOAD_STATUS, s, TTL_STATUS}); }));
+					m_uploaders.back()->setPrefix(uploadPrefix());
+				}
+			}
+			if (m_cfg.FtpUpload_present() && m_uploaders.empty())
+				LOG(Logging::LL_Warning, Logging::LC_Logger, "FtpUpload has no Host or Destination. Nothing will be uploaded");
+
+			if (m_cfg.Metrics_present() && m_cfg.Metrics().IntervalS())
+			{
+				m_lastMetrics = Metrics::snapshot();
+				for (size_t s = 0; s < Metrics::STAGES; ++s)
+					m_lastLatency[s] = Metrics::latency(Metrics::Stage(s)).snapshot();
+				m_metricsMsg = enqueueWithDelay<evMetrics>(std::chrono::seconds(m_cfg.Metrics().IntervalS()), true);
+			}
+
+			if (m_cfg.TopK_present() && m_cfg.TopK().IntervalS())
+				m_topKMsg = enqueueWithDelay<evTopK>(std::chrono::seconds(m_cfg.TopK().IntervalS()), true);
+
+			if (m_cfg.Exporter_present())
+				m_exporter.reset(new Exporter(m_log, m_cfg.Exporter(), [this]() {
+					// Atomics or the outbox's own lock only; never the writer's
+					std::shared_ptr<PSubLocal> local = m_local;
+					Outbox* outbox = local->outbox();
+					return std::vector<Exporter::Value>{
+						{ "queue_depth", "Messages waiting for the writer", double(local->queue().depth()), false },
+						{ "queue_bytes", "Bytes waiting for the writer", double(local->queue().bytes()), false },
+						{ "queue_dropped_messages_total", "Messages dropped by the overload policy", double(local->queue().droppedMsgs()), true },
+						{ "queue_dropped_bytes_total", "Bytes dropped by the overload policy", double(local->queue().droppedBytes()), true },
+						{ "outbox_files", "Closed files waiting for upload", double(outbox ? outbox->size() : 0), false } };
+				}));
+
 			if (m_cfg.Flush_present())
 				for (const loggercfg::event_string_t& e : m_cfg.Flush().Event())
 					m_hub.subscribe(PubSub::parseSubject(e));
@@ -127,6 +183,9 @@ void Logger_Dispatcher::configSys(const std::string& cfgStr)
 
 		m_haveSysCfg = true;
 
+		for (auto& u : m_uploaders)
+			u->setPrefix(uploadPrefix());
+
 	}
 	catch (xml_schema::parser_exception& ex)
 	{
@@ -152,6 +211,8 @@ void Logger_Dispatcher::eventBusConnected(HubApps::HubConnectionState state)
 		m_hub.subscribe(SUB_SHARED_CFG);
 		m_hub.subscribe(SUB_NEW_FILE);
 		m_hub.subscribe(SUB_FLUSH_FILE);
+		m_hub.subscribe(SUB_DUMP);
+		m_hub.subscribe(SUB_PROFILE);
 #if defined(_DEBUG)
 		subscribe(SUB_DIE);
 #endif
@@ -180,7 +241,9 @@ template <> void Logger_Dispatcher::processEvent<Logger_Dispatcher::evNewFile>()
 
 template <> void Logger_Dispatcher::processEvent<Logger_Dispatcher::evNewFileCreated>()
 {
-	m_newFileComplete.set();
+	m_rotating = false;
+	for (auto& u : m_uploaders)
+		u->request();
 }
 
 template <> void Logger_Dispatcher::processEvent<Logger_Dispatcher::evFlushFile>()
@@ -190,7 +253,121 @@ template <> void Logger_Dispatcher::processEvent<Logger_Dispatcher::evFlushFile>
 
 template <> void Logger_Dispatcher::processEvent<Logger_Dispatcher::evFtpUpload>()
 {
-	ftpUpload();
+	upload();
+}
+
+template <> void Logger_Dispatcher::processEvent<Logger_Dispatcher::evMetrics>()
+{
+	m_hub.sendMsg(PubSub::Message{SUB_METRICS, metrics(), TTL_STATUS});
+}
+
+// Rates, averages and latencies cover the time since the previous publish; everything else is a running total
+std::string Logger_Dispatcher::metrics()
+{
+	Metrics::Snapshot now = Metrics::snapshot();
+	double secs = std::chrono::duration<double>(now.at - m_lastMetrics.at).count();
+	auto rate = [&](Metrics::Counter c) { return secs > 0.0 ? (now[c] - m_lastMetrics[c]) / secs : 0.0; };
+	auto avgMs = [&](Metrics::Counter us, Metrics::Counter n) {
+		uint64_t count = now[n] - m_lastMetrics[n];
+		return count ? (now[us] - m_lastMetrics[us]) / 1000.0 / count : 0.0;
+	};
+
+	// Closed files plus the current one so far
+	uint64_t raw = 0, compressed = 0;
+	m_local->written(raw, compressed);
+	raw += now[Metrics::BytesWritten];
+	compressed += now[Metrics::BytesCompressed];
+
+	std::stringstream strm;
+	strm << std::fixed << std::setprecision(1)
+		<< "<Metrics IntervalS=\"" << secs << "\""
+		<< " MsgsPerSec=\"" << rate(Metrics::MsgsReceived) << "\""
+		<< " BytesPerSec=\"" << rate(Metrics::BytesReceived) << "\""
+		<< " WrittenPerSec=\"" << rate(Metrics::MsgsWritten) << "\""
+		<< " QueueDepth=\"" << m_local->queue().depth() << "\""
+		<< " QueueBytes=\"" << m_local->queue().bytes() << "\""
+		<< " QueueDropped=\"" << m_local->queue().droppedMsgs() << "\""
+		<< " Uncompressed=\"" << raw << "\""
+		<< " Compressed=\"" << compressed << "\""
+		<< " Ratio=\"" << (compressed ? double(raw) / compressed : 0.0) << "\""
+		<< " RotationMs=\"" << avgMs(Metrics::RotationUs, Metrics::Rotations) << "\""
+		<< " FlushMs=\"" << avgMs(Metrics::FlushUs, Metrics::Flushes) << "\""
+		<< " Outbox=\"" << (m_local->outbox() ? m_local->outbox()->size() : 0) << "\"";
+	for (size_t c = 0; c < Metrics::COUNTERS; ++c)
+		strm << " " << Metrics::name(Metrics::Counter(c)) << "=\"" << now.v[c] << "\"";
+	strm << ">";
+
+	// Per stage of a message's way from publish to the file, in microseconds
+	for (size_t s = 0; s < Metrics::STAGES; ++s)
+	{
+		Histogram::Snapshot h = Metrics::latency(Metrics::Stage(s)).snapshot();
+		Histogram::Snapshot d = h.since(m_lastLatency[s]);
+		strm << "<Latency Stage=\"" << Metrics::name(Metrics::Stage(s)) << "\""
+			<< " Count=\"" << d.count() << "\""
+			<< " P50=\"" << d.percentile(0.5) << "\""
+			<< " P90=\"" << d.percentile(0.9) << "\""
+			<< " P99=\"" << d.percentile(0.99) << "\""
+			<< " P999=\"" << d.percentile(0.999) << "\""
+			<< " Max=\"" << d.max << "\"/>";
+		m_lastLatency[s] = h;
+	}
+	strm << "</Metrics>";
+
+	m_lastMetrics = now;
+	return strm.str();
+}
+
+template <> void Logger_Dispatcher::processEvent<Logger_Dispatcher::evTopK>()
+{
+	m_hub.sendMsg(PubSub::Message{SUB_TOPK, topK(), TTL_STATUS});
+}
+
+// Since start. Counts may be over by up to Error, never under
+std::string Logger_Dispatcher::topK()
+{
+	SubjectTop::Table t = m_local->topK();
+
+	std::stringstream strm;
+	strm << "<TopK Msgs=\"" << t.msgs << "\" Bytes=\"" << t.bytes << "\"><ByMsgs>";
+	for (const SpaceSaving::Entry& e : t.byMsgs)
+		strm << "<Subject Name=\"" << xmlEscape(e.key) << "\" Count=\"" << e.count << "\" Error=\"" << e.error << "\"/>";
+	strm << "</ByMsgs><ByBytes>";
+	for (const SpaceSaving::Entry& e : t.byBytes)
+		strm << "<Subject Name=\"" << xmlEscape(e.key) << "\" Count=\"" << e.count << "\" Error=\"" << e.error << "\"/>";
+	strm << "</ByBytes></TopK>";
+	return strm.str();
+}
+
+// Latency over the whole run, so it is on record even without Metrics configured
+void Logger_Dispatcher::logLatency()
+{
+	for (size_t s = 0; s < Metrics::STAGES; ++s)
+	{
+		Histogram::Snapshot h = Metrics::latency(Metrics::Stage(s)).snapshot();
+		if (!h.count())
+			continue;
+		LOG(Logging::LL_Info, Logging::LC_Logger, "Latency " << Metrics::name(Metrics::Stage(s)) << " us:"
+			<< " count " << h.count() << " p50 " << h.percentile(0.5) << " p90 " << h.percentile(0.9)
+			<< " p99 " << h.percentile(0.99) << " p99.9 " << h.percentile(0.999) << " max " << h.max);
+	}
+}
+
+void Logger_Dispatcher::upload()
+{
+	if (m_uploaders.empty())
+		return;
+
+	// Streaming ships the live file as it grows, so there is nothing to rotate
+	if (m_cfg.FtpUpload().StreamS())
+	{
+		for (auto& u : m_uploaders)
+			u->request();
+		return;
+	}
+
+	// Rotate once for all destinations; evNewFileCreated starts them
+	if (!m_rotating.exchange(true))
+		m_local->enqueue<NewfileEvtSync>();
 }
 
 void Logger_Dispatcher::processMsg(PubSub::Message&& m)
@@ -198,6 +375,7 @@ void Logger_Dispatcher::processMsg(PubSub::Message&& m)
 	std::string str;
 	LOG(Logging::LL_Debug, Logging::LC_Logger, "Received msg " << PubSub::toString(m.subject, str));
 
+	Profiler::tag(Profiler::RoleDispatcher);
 	std::unique_lock<std::mutex> s(m_dispLock);
 
 	if (PubSub::match(SUB_CFG, m.subject))
@@ -208,6 +386,14 @@ void Logger_Dispatcher::processMsg(PubSub::Message&& m)
 		m_local->enqueue<NewfileEvt>();
 	else if (PubSub::match(SUB_FLUSH_FILE, m.subject))
 		m_local->enqueue<PSubLocal::FlushEvt>();
+	else if (PubSub::match(SUB_DUMP, m.subject))
+		dumpTrace();
+	else if (PubSub::match(SUB_PROFILE, m.subject))
+	{
+		if (!m_profiler)
+			m_profiler.reset(new Profiler(m_log, [this](const std::string& s) { m_hub.sendMsg(PubSub::Message{SUB_PROFILE_STATUS, s, TTL_STATUS}); }));
+		m_profiler->start(m_cfg.LogPath(), m.payload);
+	}
 #if defined(_DEBUG)
 	else if (PubSub::match(SUB_DIE, m.subject))
 		SetEvent(g_exitEvent);
@@ -216,16 +402,16 @@ void Logger_Dispatcher::processMsg(PubSub::Message&& m)
 	{
 		if (m_cfg.FtpUpload_present())
 			for (const loggercfg::event_string_t& e : m_cfg.FtpUpload().Event())
-				if (PubSub::match(PubSub::parseSubject(e), m.subject) && matchEvent(e, m.payload))
+				if (trigger(e, m))
 				{
 					LOG(Logging::LL_Info, Logging::LC_Logger, "Upload trigger \"" << PubSub::toString(m.subject) << "\" detected");
-					ftpUpload();
+					upload();
 					break;
 				}
 
 		if (m_cfg.Flush_present())
 			for (const loggercfg::event_string_t& e : m_cfg.Flush().Event())
-				if (PubSub::match(PubSub::parseSubject(e), m.subject) && matchEvent(e, m.payload))
+				if (trigger(e, m))
 				{
 					LOG(Logging::LL_Info, Logging::LC_Logger, "Flush trigger \"" << PubSub::toString(m.subject) << "\" detected");
 					m_local->enqueue<PSubLocal::FlushEvt>();
@@ -234,7 +420,7 @@ void Logger_Dispatcher::processMsg(PubSub::Message&& m)
 
 		if (m_cfg.NewFile_present())
 			for (const loggercfg::event_string_t& e : m_cfg.NewFile().Event())
-				if (PubSub::match(PubSub::parseSubject(e), m.subject) && matchEvent(e, m.payload))
+				if (trigger(e, m))
 				{
 					LOG(Logging::LL_Info, Logging::LC_Logger, "New file trigger \"" << PubSub::toString(m.subject) << "\" detected");
 					m_local->enqueue<NewfileEvt>();
@@ -243,245 +429,6 @@ void Logger_Dispatcher::processMsg(PubSub::Message&& m)
 	}
 }
 
-void Logger_Dispatcher::ftpUpload()
-{
-	// synchronous call
-	m_local->enqueue<NewfileEvtSync>();
-	m_newFileComplete.wait();
-	BF::path currFile(m_local->currentFileName());
-
-#ifdef WIN32
-	SOCKET sock = 0;
-#else
-	int sock = 0;
-#endif
-	LIBSSH2_SESSION* session = nullptr;
-	LIBSSH2_SFTP *sftp_session = nullptr;
-
-	struct myerr
-	{
-		std::string msg;
-};
-
-	try
-	{
-		int rc;
-		rc = libssh2_init(0);
-		if (rc)
-		{
-			LOG(Logging::LL_Warning, Logging::LC_Logger, "libssh2 initialization failed " << rc);
-			return;
-		}
-
-		session = libssh2_session_init();
-		if (session == NULL)
-		{
-			LOG(Logging::LL_Warning, Logging::LC_Logger, "libssh2 session initialization failed");
-			return;
-		}
-
-		sock = socket(AF_INET, SOCK_STREAM, 0);
-
-		addrinfo hints, *res;
-		int errcode;
-
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_INET;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags |= AI_CANONNAME;
-
-		errcode = getaddrinfo(m_cfg.FtpUpload().Host().c_str(), NULL, &hints, &res);
-		if (errcode != 0)
-		{
-			LOG(Logging::LL_Warning, Logging::LC_Logger, "getaddrinfo fail: " << errcode);
-			return;
-		}
-
-		while (res)
-		{
-			if (res->ai_family == AF_INET)
-			{
-
-				struct sockaddr_in sin = *((struct sockaddr_in *)res->ai_addr);
-				sin.sin_port = htons(22);
-				if (::connect(sock, (struct sockaddr*)(&sin), sizeof(struct sockaddr_in)) == 0)
-				{
-					LOG(Logging::LL_Info, Logging::LC_Logger, "Connected");
-					break;
-				}
-			}
-			res = res->ai_next;
-		}
-		if (!res)
-		{
-			std::stringstream strm; strm << "Failed to connect to " << m_cfg.FtpUpload().Host() << ":22";
-			throw myerr{ strm.str() };
-		}
-
-		libssh2_session_set_blocking(session, 1);
-		rc = libssh2_session_handshake(session, sock);
-
-		if (rc)
-		{
-			std::stringstream strm; strm << "Failure establishing SSH session: " << rc;
-			throw myerr{ strm.str() };
-		}
-
-		/* At this point we havn't yet authenticated.  The first thing to do
-		* is check the hostkey's fingerprint against our known hosts Your app
-		* may have it hard coded, may go to a file, may present it to the
-		* user, that's your call
-		*/
-		//const char *fingerprint = libssh2_hostkey_hash(session, LIBSSH2_HOSTKEY_HASH_SHA1);
-		//fprintf(stderr, "Fingerprint: ");
-		//for (i = 0; i < 20; i++)
-		//{
-		//	fprintf(stderr, "%02X ", (unsigned char)fingerprint[i]);
-		//}
-		//fprintf(stderr, "\n");
-
-		//if (auth_pw)
-		//{
-		/* We could authenticate via password */
-		if (libssh2_userauth_password(session, m_cfg.FtpUpload().username().c_str(), m_cfg.FtpUpload().password().c_str()))
-			throw myerr{ "Authentication by username/password failed" };
-		//}
-		//else
-		//{
-		//	/* Or by public key */
-		//	const char *pubkey = "/home/username/.ssh/id_rsa.pub";
-		//	const char *privkey = "/home/username/.ssh/id_rsa.pub";
-		//	if (libssh2_userauth_publickey_fromfile(session, username,
-
-		//		pubkey, privkey,
-		//		password))
-		//	{
-		//		LOG(Logging::LL_Debug, Logging::LC_Logger, "Authentication by public key failed");
-		//		goto shutdown;
-		//	}
-		//}
-
-		sftp_session = libssh2_sftp_init(session);
-		if (!sftp_session)
-			throw myerr{ "Unable to init SFTP session" };
-
-		BF::path p(cfg().LogPath());
-		std::string fnroot = cfg().FileNameRoot();
-		auto fnprefix = [&]()
-		{
-			if (m_haveSysCfg)
-			{
-				if (m_syscfg.uuid_present())
-					return m_syscfg.uuid() + '_';
-
-				if (!m_syscfg.TerminalID().empty())
-					return m_syscfg.TerminalID() + '_';
-			}
-			return std::string();
-		};
-		std::string destpath = m_cfg.FtpUpload().path() + '/' + fnprefix();
-		for (BF::directory_entry d : BF::directory_iterator(p))
-		{
-			if (d.path().filename().empty())
-				continue;
-
-			std::string droot = d.path().filename().string().substr(0, fnroot.size());
-			if (droot == fnroot && d.path().filename().string() != currFile.filename().string())
-			{
-				std::string destfname = destpath + d.path().filename().string();
-				LOG(Logging::LL_Info, Logging::LC_Logger, "Uploading " << d.path().filename());
-
-				LIBSSH2_SFTP_HANDLE *sftp_handle;
-				libssh2_session_set_blocking(session, 1);
-
-				/* Request a file via SFTP */
-				sftp_handle = libssh2_sftp_open(sftp_session, destfname.c_str(),
-												LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT /*| LIBSSH2_FXF_TRUNC*/,
-												LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
-												LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH);
-
-				if (!sftp_handle)
-				{
-					char* errmsg;
-					libssh2_session_last_error(session, &errmsg, nullptr, 0);
-					uint32_t sftperr = libssh2_sftp_last_error(sftp_session);
-					LOG(Logging::LL_Warning, Logging::LC_Logger, "Unable to open " << destfname << " with SFTP. " << errmsg << " " << sftperr);
-				}
-				else
-				{
-					LIBSSH2_SFTP_ATTRIBUTES attr;
-					libssh2_sftp_fstat(sftp_handle, &attr);
-					libssh2_sftp_seek64(sftp_handle, attr.filesize);
-
-					FILE *loc;
-					fopen_s(&loc, d.path().string().c_str(), "rb");
-					if (fseek(loc, attr.filesize, SEEK_SET))
-					{
-						LOG(Logging::LL_Warning, Logging::LC_Logger, "Remote file already larger than local ");
-						continue;
-					}
-
-					char buff[0xFFFFu] = { 0 };
-					char* ptr = 0;
-					rc = -1;
-					libssh2_session_set_blocking(session, 0);
-					do
-					{
-						size_t nread = fread(buff, 1, sizeof(buff), loc);
-						if (nread <= 0)
-						{
-							rc = nread == 0 ? 0 : rc;
-							break;
-						}
-
-						do
-						{
-							/* write data in a loop until we block */
-							rc = libssh2_sftp_write(sftp_handle, buff, nread);
-
-							if (rc == 0 || rc == LIBSSH2_ERROR_EAGAIN) // Would have blocked or nothing sent
-							{
-								std::this_thread::sleep_for(500ms);
-								continue;
-							}
-
-							if (rc < 0)
-								break;
-							ptr += rc;
-							nread -= rc;
-						} while (nread);
-
-					} while (rc > 0);
-
-					fclose(loc);
-					libssh2_sftp_close(sftp_handle);
-
-					if (rc == 0)
-					{
-						LOG(Logging::LL_Info, Logging::LC_Logger, "Upload success. Deleting " << d.path().filename());
-						BF::remove(d.path());
-					}
-				}
-			}
-		}
-
-		libssh2_sftp_shutdown(sftp_session);
-	}
-	catch (const myerr& e)
-	{
-		LOG(Logging::LL_Warning, Logging::LC_Logger, e.msg);
-	}
-
-#ifdef WIN32
-	closesocket(sock);
-#else
-	close(sock);
-#endif
-	libssh2_session_disconnect(session, "Normal Shutdown");
-	libssh2_session_free(session);
-	libssh2_exit();
-}
-
 //void Logger_Dispatcher::ftpUpload()
 //{
 //	// synchronous call
@@ -640,60 +587,43 @@ void Logger_Dispatcher::ftpUpload()
 //	return c < tries;
 //}
 
-bool Logger_Dispatcher::matchEvent(const loggercfg::event_string_t& ev, const std::string& payload)
+std::string Logger_Dispatcher::uploadPrefix() const
 {
-	pugi::xpath_value_type xPathType = pugi::xpath_type_string;
-	bool found = true;
-	std::string foundText;
-
-	if (ev.xpath_present())
+	if (m_haveSysCfg)
 	{
-		pugi::xml_document doc;
-		pugi::xml_parse_result r = doc.load_string(payload.c_str());
-		if (r.status != pugi::xml_parse_status::status_ok)
-		{
-			LOG(Logging::LL_Warning, Logging::LC_Logger, "Payload for event " << ev << " not valid XML");
-			return false;
-		}
+		if (m_syscfg.uuid_present())
+			return m_syscfg.uuid() + '_';
 
-		try
-		{
-			pugi::xpath_query xp(ev.xpath().c_str());
-			xPathType = xp.return_type();
-			switch (xPathType)
-			{
-			case pugi::xpath_type_node_set:
-				found = !xp.evaluate_node_set(doc).empty();
-				break;
-			case pugi::xpath_type_number:
-				found = xp.evaluate_number(doc) != 0.0;
-				break;
-			case pugi::xpath_type_string:
-				foundText = xp.evaluate_string(doc);
-				found = !foundText.empty();
-				break;
-			case pugi::xpath_type_boolean:
-				found = xp.evaluate_boolean(doc);
-				break;
-			case pugi::xpath_type_none:// Unknown type (query failed to compile)
-			default:
-				LOG(Logging::LL_Warning, Logging::LC_Logger, "Xpath for event " << ev << " not valid");
-				found = false;
-				break;
-			}
-		}
-		catch (const pugi::xpath_exception& ex)
-		{
-			std::cerr << ex.result().description();
-			return 1;
-		}
+		if (!m_syscfg.TerminalID().empty())
+			return m_syscfg.TerminalID() + '_';
 	}
+	return std::string();
+}
 
-	if (ev.regex_present() && found && xPathType == pugi::xpath_type_string)
-	{
-		std::regex rg(ev.regex());
-		found = std::regex_search(ev.xpath_present() ? foundText : payload, rg);
-	}
+bool Logger_Dispatcher::trigger(const loggercfg::event_string_t& ev, const PubSub::Message& m)
+{
+	Metrics::add(Metrics::TriggersEvaluated);
+	if (!EventMatch::subject(ev, m.subject))
+		return false;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	std::string error;
+	bool found = EventMatch::payload(ev, m.payload, error);
+	if (!error.empty())
+		LOG(Logging::LL_Warning, Logging::LC_Logger, error);
+	if (!found)
+		return false;
+
+	Metrics::add(Metrics::TriggersMatched);
+	Trace::record(Trace::Trigger, m.payload.size(), Trace::usSince(started));
+	return true;
+}
 
-	return found;
+void Logger_Dispatcher::dumpTrace()
+{
+	int n = Trace::dump();
+	if (n < 0)
+		LOG(Logging::LL_Warning, Logging::LC_Logger, "Cannot write a trace dump to " << m_cfg.LogPath());
+	else
+		LOG(Logging::LL_Info, Logging::LC_Logger, "Trace written to " << Trace::dumpPath(n));
 }
@@ -5,17 +5,14 @@
 #include "HubApp/HubApp.h"
 #include "configuration.hxx"
 #include "syscfg.hxx"
+#include "Metrics.h"
 
 #include <thread>
+#include <atomic>
+#include <array>
 #include <memory>
+#include <vector>
 #include <boost/asio.hpp>
-#if defined(WIN32)
-#include <libssh2/libssh2.h>
-#include <libssh2/libssh2_sftp.h>
-#else
-#include <libssh2.h>
-#include <libssh2_sftp.h>
-#endif
 
 #if defined(_DEBUG) && defined(WIN32)
 extern HANDLE g_exitEvent;
@@ -33,6 +30,10 @@ namespace Logging
 
 class ConfigMsg;
 class PSubLocal;
+class Shaper;
+class Uploader;
+class Exporter;
+class Profiler;
 
 class Logger_Dispatcher : public Task::TActiveTask<Logger_Dispatcher>, public Logging::LogClient
 {
@@ -53,16 +54,31 @@ class Logger_Dispatcher : public Task::TActiveTask<Logger_Dispatcher>, public Lo
 	void configSys(const std::string& cfgStr);
 	bool m_haveSysCfg = false;
 
-	VEvent m_newFileComplete;
-
 	std::shared_ptr<PSubLocal> m_local;
+	std::unique_ptr<Shaper> m_shaper;  // shared by, so outliving, the uploaders
+	std::vector<std::unique_ptr<Uploader>> m_uploaders;
+	std::atomic<bool> m_rotating{false};
+
+	std::unique_ptr<Exporter> m_exporter;
+	std::unique_ptr<Profiler> m_profiler;
+
+	Task::MsgDelayMsgPtr m_metricsMsg;
+	Metrics::Snapshot m_lastMetrics;
+	std::array<Histogram::Snapshot, Metrics::STAGES> m_lastLatency;
+	std::string metrics();
+	void logLatency();
+
+	Task::MsgDelayMsgPtr m_topKMsg;
+	std::string topK();
 
 	void start();
-	void ftpUpload();
+	void upload();
+	std::string uploadPrefix() const;
 	//bool upload(CURL *curlhandle, const std::string& remotepath, const std::string& localpath, long timeout, long tries);
 	//bool sftpResumeUpload(CURL *curlhandle, const std::string& remotepath, const std::string& localpath);
 	//curl_off_t sftpGetRemoteFileSize(const char *i_remoteFile);
-	bool matchEvent(const loggercfg::event_string_t& ev, const std::string& payload);
+	bool trigger(const loggercfg::event_string_t& ev, const PubSub::Message& m);
+	void dumpTrace();
 
 public:
 	explicit Logger_Dispatcher(Logging::LogFile& log, const std::string& psubAddr = "127.0.0.1");
@@ -79,6 +95,8 @@ public:
 	struct evNewFileCreated;
 	struct evFlushFile;
 	struct evFtpUpload;
+	struct evMetrics;
+	struct evTopK;
 	template <typename M> void processEvent();
 
 };
@@ -0,0 +1,58 @@
+#include "Metrics.h"
+
+namespace
+{
+	// More shards than busy threads in practice; threads beyond that share
+	const size_t SHARDS = 16;
+
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> v[Metrics::COUNTERS];
+	};
+
+	Shard g_shards[SHARDS];
+	std::atomic<size_t> g_nextShard{0};
+
+	const char* const NAMES[Metrics::COUNTERS] =
+	{
+		"MsgsReceived", "BytesReceived", "MsgsWritten", "BytesWritten", "BytesCompressed",
+		"Rotations", "RotationUs", "Flushes", "FlushUs",
+		"TriggersEvaluated", "TriggersMatched",
+		"UploadFiles", "UploadBytes", "UploadFailures"
+	};
+
+	const char* const STAGE_NAMES[Metrics::STAGES] = { "Bus", "Queue", "Serialize", "Compress", "Durable" };
+
+	Histogram g_latency[Metrics::STAGES];
+}
+
+const char* Metrics::name(Counter c)
+{
+	return NAMES[c];
+}
+
+const char* Metrics::name(Stage s)
+{
+	return STAGE_NAMES[s];
+}
+
+Histogram& Metrics::latency(Stage s)
+{
+	return g_latency[s];
+}
+
+std::atomic<uint64_t>* Metrics::detail::shard()
+{
+	thread_local std::atomic<uint64_t>* s = g_shards[g_nextShard.fetch_add(1, std::memory_order_relaxed) % SHARDS].v;
+	return s;
+}
+
+Metrics::Snapshot Metrics::snapshot()
+{
+	Snapshot r;
+	r.at = std::chrono::steady_clock::now();
+	for (const Shard& s : g_shards)
+		for (size_t c = 0; c < COUNTERS; ++c)
+			r.v[c] += s.v[c].load(std::memory_order_relaxed);
+	return r;
+}
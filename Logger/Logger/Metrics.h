@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Histogram.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Process wide health counters, cheap enough for the message path. Each
+// thread increments its own cache line sized shard with relaxed atomics, so
+// writers never contend; the shards are only summed when a snapshot is taken.
+namespace Metrics
+{
+	enum Counter
+	{
+		MsgsReceived,       // everything the hub handler is given
+		BytesReceived,      // payload bytes of the above
+		MsgsWritten,        // records written, after filtering, sampling and change-only
+		BytesWritten,       // uncompressed bytes of closed files
+		BytesCompressed,    // on disk bytes of closed files
+		Rotations,
+		RotationUs,
+		Flushes,
+		FlushUs,
+		TriggersEvaluated,  // upload, flush and new file trigger patterns checked
+		TriggersMatched,
+		UploadFiles,        // files complete at a destination
+		UploadBytes,
+		UploadFailures,     // transfers that failed or lost their session
+		COUNTERS
+	};
+
+	const char* name(Counter c);
+
+	namespace detail
+	{
+		std::atomic<uint64_t>* shard();
+	}
+
+	inline void add(Counter c, uint64_t n = 1)
+	{
+		detail::shard()[c].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	struct Snapshot
+	{
+		std::chrono::steady_clock::time_point at;
+		std::array<uint64_t, COUNTERS> v{};
+
+		uint64_t operator[](Counter c) const { return v[c]; }
+	};
+
+	Snapshot snapshot();
+
+	// Where a message's time goes between publisher and disk, in microseconds
+	enum Stage
+	{
+		Bus,        // publish to receive, from the message's age
+		Queue,      // receive to dequeue by the writer
+		Serialize,  // dequeue to record line built
+		Compress,   // line handed to zlib
+		Durable,    // compressed to flushed to the file by a flush, stream tick or rotation
+		STAGES
+	};
+
+	const char* name(Stage s);
+	Histogram& latency(Stage s);
+
+	// Measures the enclosing scope into a duration counter, in microseconds
+	class ScopeTimer
+	{
+	public:
+		ScopeTimer(Counter c) : m_counter(c), m_start(std::chrono::steady_clock::now()) {}
+		~ScopeTimer() { add(m_counter, uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count())); }
+
+	private:
+		Counter m_counter;
+		std::chrono::steady_clock::time_point m_start;
+	};
+}
@@ -0,0 +1,624 @@
+#include "Outbox.h"
+#include "Destination.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace Logging
+{
+	const uint32_t LC_Outbox = 0x1000;
+	template <> const char* getLCStr<LC_Outbox   >() { return "Outbox  "; }
+}
+
+using namespace Logging;
+
+namespace
+{
+	const char* JOURNAL = "journal";
+	const char* BATCH_EXT = ".tar";
+
+	// Destination of OFFSET lines written before there could be more than one
+	const char* DEFAULT_DEST = "default";
+
+	// Rewrite the journal once it holds this many more records than live entries
+	const uint32_t COMPACT_SLACK = 1000;
+}
+
+Outbox::Outbox(Logging::LogFile& log, const loggercfg::Logger& cfg)
+	: Logging::LogClient(log)
+	, m_logPath(cfg.LogPath())
+	, m_dir(m_logPath / "outbox")
+	, m_journalPath(m_dir / JOURNAL)
+{
+	for (const Destination& d : Destination::fromConfig(cfg.FtpUpload()))
+	{
+		m_destinations.insert(d.name);
+		if (d.required)
+			m_required.insert(d.name);
+	}
+
+	// With nothing required, every destination must have a file before it goes
+	if (m_required.empty())
+		m_required = m_destinations;
+
+	BF::create_directories(m_dir);
+
+	std::unique_lock<std::mutex> s(m_lk);
+	load();
+
+	// Files moved in before their ADD reached the journal
+	std::set<std::string> known;
+	for (const auto& f : m_files)
+	{
+		known.insert(f.first);
+		for (const Entry& m : f.second.members)
+			known.insert(m.name);
+	}
+	for (BF::directory_entry d : BF::directory_iterator(m_dir))
+		if (d.path().filename() != JOURNAL && d.path().extension() != ".tmp" && !known.count(d.path().filename().string()))
+			adopt(d.path());
+
+	// Files closed by an earlier run that never got rotated in
+	std::string fnroot = cfg.FileNameRoot();
+	for (BF::directory_entry d : BF::directory_iterator(m_logPath))
+		if (BF::is_regular_file(d.path()) && d.path().filename().string().substr(0, fnroot.size()) == fnroot)
+		{
+			BF::path dest = m_dir / d.path().filename();
+			BF::rename(d.path(), dest);
+			adopt(dest);
+		}
+
+	compact();
+
+	LOG(LL_Info, LC_Outbox, files() << " files waiting to upload to " << m_destinations.size() << " destinations");
+}
+
+Outbox::~Outbox()
+{
+	if (m_journal)
+		fclose(m_journal);
+}
+
+void Outbox::load()
+{
+	std::ifstream in(m_journalPath.string());
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream strm(line);
+		std::string op, name, dest;
+		if (!(strm >> op >> std::quoted(name)))
+			continue;
+
+		auto it = m_files.find(name);
+		if (op == "ADD")
+		{
+			File f;
+			strm >> f.size;
+			takeLive(name, f);
+			m_files[name] = f;
+		}
+		else if (op == "CRC" && it != m_files.end())
+		{
+			uint32_t c;
+			if (strm >> std::hex >> c)
+				it->second.crc = c;
+		}
+		else if (op == "TAR")
+		{
+			File f;
+			std::string member;
+			while (strm >> std::quoted(member))
+			{
+				auto m = m_files.find(member);
+				if (m != m_files.end())
+				{
+					f.members.push_back(Entry{ member, m->second.size, m->second.crc, 0, {} });
+					m_files.erase(m);
+				}
+			}
+			if (!f.members.empty())
+				m_files[name] = f;
+		}
+		else if (op == "OFFSET")
+		{
+			uint64_t offset = 0;
+			strm >> offset >> std::quoted(dest);
+			if (dest.empty())
+				dest = DEFAULT_DEST;
+
+			if (it != m_files.end())
+				it->second.offset[dest] = offset;
+			else
+				m_live[name][dest] = offset;
+		}
+		else if (op == "SENT" && it != m_files.end())
+		{
+			strm >> std::quoted(dest);
+			it->second.sent.insert(dest);
+		}
+		else if (op == "DONE" || op == "DROP")
+			m_files.erase(name);
+	}
+
+	for (auto it = m_files.begin(); it != m_files.end();)
+	{
+		File& f = it->second;
+		if (complete(f))
+		{
+			// Stopped between the last SENT and its DONE
+			std::string name = it->first;
+			++it;
+			remove(name, "DONE");
+			continue;
+		}
+
+		if (f.members.empty())
+		{
+			if (check(it->first, f))
+				++it;
+			else
+				it = m_files.erase(it);
+			continue;
+		}
+
+		// An archive stands only while its members are as they were batched
+		bool intact = true;
+		for (Entry& m : f.members)
+		{
+			File mf;
+			mf.size = m.size;
+			mf.crc = m.crc;
+			intact &= check(m.name, mf) && mf.crc.has_value();
+		}
+		if (intact)
+		{
+			f.size = archiveOf(f.members)->size();
+			++it;
+			continue;
+		}
+
+		LOG(LL_Warning, LC_Outbox, "Archive " << it->first << " has lost or changed members. Uploading them individually");
+		std::vector<Entry> members = std::move(f.members);
+		it = m_files.erase(it);
+		for (const Entry& m : members)
+		{
+			boost::system::error_code ec;
+			File mf;
+			mf.size = BF::file_size(path(m.name), ec);
+			if (!ec)
+				m_files[m.name] = mf;
+		}
+	}
+}
+
+bool Outbox::check(const std::string& name, File& f)
+{
+	boost::system::error_code ec;
+	uint64_t size = BF::file_size(path(name), ec);
+	if (ec)
+	{
+		LOG(LL_Warning, LC_Outbox, "Journalled file " << name << " is missing");
+		return false;
+	}
+
+	if (size != f.size)
+	{
+		LOG(LL_Warning, LC_Outbox, "Journalled file " << name << " has changed size. Uploading from the start");
+		f.size = size;
+		f.crc.reset();
+		f.offset.clear();
+		f.sent.clear();
+	}
+	return true;
+}
+
+void Outbox::adopt(const BF::path& file)
+{
+	File f;
+	f.size = BF::file_size(file);
+	takeLive(file.filename().string(), f);
+	m_files[file.filename().string()] = f;
+	LOG(LL_Info, LC_Outbox, "Adopted " << file.filename());
+}
+
+uint32_t Outbox::crc(const BF::path& file)
+{
+	uLong c = crc32(0L, Z_NULL, 0);
+
+	std::ifstream in(file.string(), std::ios::binary);
+	std::vector<char> buff(256 * 1024);
+	while (in)
+	{
+		in.read(buff.data(), buff.size());
+		if (in.gcount() > 0)
+			c = crc32(c, reinterpret_cast<const Bytef*>(buff.data()), uInt(in.gcount()));
+	}
+	return uint32_t(c);
+}
+
+bool Outbox::complete(const File& f) const
+{
+	if (m_required.empty())
+		return false;
+
+	for (const std::string& d : m_required)
+		if (!f.sent.count(d))
+			return false;
+	return true;
+}
+
+void Outbox::record(const std::string& op, const std::string& name, const std::string& args)
+{
+	if (m_journal)
+	{
+		std::stringstream strm;
+		strm << op << " " << std::quoted(name);
+		if (!args.empty())
+			strm << " " << args;
+		strm << "\n";
+
+		fputs(strm.str().c_str(), m_journal);
+		fflush(m_journal);
+	}
+
+	if (++m_records > m_files.size() * (2 + m_destinations.size()) + COMPACT_SLACK)
+		compact();
+}
+
+void Outbox::compact()
+{
+	if (m_journal)
+	{
+		fclose(m_journal);
+		m_journal = nullptr;
+	}
+
+	BF::path tmp(m_journalPath.string() + ".tmp");
+	{
+		std::ofstream out(tmp.string(), std::ios::trunc);
+		auto add = [&out](const std::string& name, uint64_t size, const std::optional<uint32_t>& crc)
+		{
+			out << "ADD " << std::quoted(name) << " " << size << "\n";
+			if (crc)
+				out << "CRC " << std::quoted(name) << " " << std::hex << *crc << std::dec << "\n";
+		};
+
+		for (const auto& f : m_files)
+		{
+			if (f.second.members.empty())
+				add(f.first, f.second.size, f.second.crc);
+			else
+			{
+				for (const Entry& m : f.second.members)
+					add(m.name, m.size, m.crc);
+				out << "TAR " << std::quoted(f.first);
+				for (const Entry& m : f.second.members)
+					out << " " << std::quoted(m.name);
+				out << "\n";
+			}
+
+			for (const auto& o : f.second.offset)
+				if (o.second)
+					out << "OFFSET " << std::quoted(f.first) << " " << o.second << " " << std::quoted(o.first) << "\n";
+			for (const std::string& d : f.second.sent)
+				out << "SENT " << std::quoted(f.first) << " " << std::quoted(d) << "\n";
+		}
+
+		for (auto it = m_live.begin(); it != m_live.end();)
+			if (BF::exists(m_logPath / it->first))
+			{
+				for (const auto& o : it->second)
+					out << "OFFSET " << std::quoted(it->first) << " " << o.second << " " << std::quoted(o.first) << "\n";
+				++it;
+			}
+			else
+				it = m_live.erase(it);
+	}
+	BF::rename(tmp, m_journalPath);
+
+	m_records = 0;
+	m_journal = fopen(m_journalPath.string().c_str(), "a");
+	if (!m_journal)
+		LOG(LL_Warning, LC_Outbox, "Unable to open journal " << m_journalPath);
+}
+
+void Outbox::add(const BF::path& file)
+{
+	BF::path dest = m_dir / file.filename();
+	boost::system::error_code ec;
+	BF::rename(file, dest, ec);
+	if (ec)
+	{
+		LOG(LL_Warning, LC_Outbox, "Unable to move " << file << " to the outbox: " << ec.message());
+		return;
+	}
+
+	File f;
+	f.size = BF::file_size(dest, ec);
+	std::string name = dest.filename().string();
+
+	std::unique_lock<std::mutex> s(m_lk);
+	takeLive(name, f);
+	m_files[name] = f;
+	record("ADD", name, std::to_string(f.size));
+}
+
+std::vector<Outbox::Entry> Outbox::pending(const std::string& dest)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	std::vector<Entry> r;
+	for (auto& f : m_files)
+		if (!f.second.sent.count(dest))
+		{
+			auto o = f.second.offset.find(dest);
+			r.push_back(Entry{ f.first, f.second.size, f.second.crc, o != f.second.offset.end() ? o->second : 0, f.second.members });
+			f.second.claimed.insert(dest);
+		}
+	return r;
+}
+
+void Outbox::release(const std::string& dest)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	for (auto& f : m_files)
+		f.second.claimed.erase(dest);
+}
+
+size_t Outbox::size() const
+{
+	std::unique_lock<std::mutex> s(m_lk);
+	return files();
+}
+
+size_t Outbox::files() const
+{
+	size_t n = 0;
+	for (const auto& f : m_files)
+		n += std::max<size_t>(1, f.second.members.size());
+	return n;
+}
+
+std::vector<std::string> Outbox::unverified() const
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	std::vector<std::string> r;
+	for (const auto& f : m_files)
+		if (!f.second.verified)
+			r.push_back(f.first);
+	return r;
+}
+
+void Outbox::verify(const std::string& name)
+{
+	std::vector<std::string> names;
+	{
+		std::unique_lock<std::mutex> s(m_lk);
+		auto it = m_files.find(name);
+		if (it == m_files.end() || it->second.verified)
+			return;
+
+		if (it->second.members.empty())
+			names.push_back(name);
+		for (const Entry& m : it->second.members)
+			names.push_back(m.name);
+	}
+
+	// Not under the lock, so rotation and other destinations are not held up
+	// by the reads
+	std::vector<uint32_t> crcs;
+	for (const std::string& n : names)
+		crcs.push_back(crc(path(n)));
+
+	std::unique_lock<std::mutex> s(m_lk);
+	auto it = m_files.find(name);
+	if (it == m_files.end() || it->second.verified)
+		return;
+	File& f = it->second;
+
+	bool changed = false;
+	if (!f.members.empty())
+	{
+		for (size_t i = 0; i < f.members.size() && i < crcs.size(); ++i)
+			if (f.members[i].crc != crcs[i])
+			{
+				f.members[i].crc = crcs[i];
+				changed = true;
+			}
+
+		// The INDEX holds the CRCs, so the archive is no longer what was sent
+		if (changed)
+			f.size = archiveOf(f.members)->size();
+	}
+	else if (f.crc != crcs.front())
+	{
+		changed = f.crc.has_value();
+		f.crc = crcs.front();
+		if (!changed)
+		{
+			std::stringstream strm;
+			strm << std::hex << crcs.front();
+			record("CRC", name, strm.str());
+		}
+	}
+
+	if (changed)
+	{
+		LOG(LL_Warning, LC_Outbox, "Journalled file " << name << " has changed. Uploading from the start");
+		f.offset.clear();
+		f.sent.clear();
+		compact();
+	}
+
+	f.verified = true;
+}
+
+void Outbox::confirm(const std::string& name, const std::string& dest, uint64_t offset)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	// Neither in the outbox nor live: pruned while it was being sent
+	auto it = m_files.find(name);
+	if (it == m_files.end() && !BF::exists(m_logPath / name))
+		return;
+
+	uint64_t& confirmed = it != m_files.end() ? it->second.offset[dest] : m_live[name][dest];
+	if (confirmed == offset)
+		return;
+
+	confirmed = offset;
+	std::stringstream strm;
+	strm << offset << " " << std::quoted(dest);
+	record("OFFSET", name, strm.str());
+}
+
+uint64_t Outbox::liveOffset(const std::string& name, const std::string& dest) const
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	auto it = m_live.find(name);
+	if (it == m_live.end())
+		return 0;
+
+	auto o = it->second.find(dest);
+	return o != it->second.end() ? o->second : 0;
+}
+
+void Outbox::takeLive(const std::string& name, File& f)
+{
+	auto it = m_live.find(name);
+	if (it == m_live.end())
+		return;
+
+	for (const auto& o : it->second)
+		f.offset[o.first] = std::min(o.second, f.size);
+	m_live.erase(it);
+}
+
+void Outbox::sent(const std::string& name, const std::string& dest)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	auto it = m_files.find(name);
+	if (it == m_files.end() || !it->second.sent.insert(dest).second)
+		return;
+
+	std::stringstream strm;
+	strm << std::quoted(dest);
+	record("SENT", name, strm.str());
+
+	if (complete(it->second))
+	{
+		LOG(LL_Info, LC_Outbox, "Deleting " << name << ", uploaded to every required destination");
+		remove(name, "DONE");
+	}
+}
+
+void Outbox::remove(const std::string& name, const char* op)
+{
+	auto it = m_files.find(name);
+	if (it == m_files.end())
+		return;
+
+	boost::system::error_code ec;
+	if (it->second.members.empty())
+		BF::remove(path(name), ec);
+	for (const Entry& m : it->second.members)
+		BF::remove(path(m.name), ec);
+
+	m_files.erase(it);
+	record(op, name);
+}
+
+void Outbox::prune(size_t keep)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+
+	// An archive counts as the files in it
+	while (files() > keep)
+	{
+		auto it = m_files.begin();
+		LOG(LL_Warning, LC_Outbox, "Outbox full. Deleting " << it->first << ", " << it->second.size << " bytes, uploaded to " << it->second.sent.size() << " of " << m_destinations.size() << " destinations");
+		remove(it->first, "DROP");
+	}
+}
+
+std::unique_ptr<TarStream> Outbox::archive(const Entry& e) const
+{
+	if (e.members.empty())
+		return nullptr;
+
+	return archiveOf(e.members);
+}
+
+std::unique_ptr<TarStream> Outbox::archiveOf(const std::vector<Entry>& members) const
+{
+	std::stringstream index;
+	std::vector<TarStream::Member> files;
+	for (const Entry& m : members)
+	{
+		index << m.name << " " << m.size << " " << std::hex << m.crc.value_or(0) << std::dec << "\n";
+
+		boost::system::error_code ec;
+		std::time_t mtime = BF::last_write_time(path(m.name), ec);
+		files.push_back(TarStream::Member{ m.name, path(m.name), m.size, ec ? 0 : mtime });
+	}
+	return std::unique_ptr<TarStream>(new TarStream(index.str(), std::move(files)));
+}
+
+size_t Outbox::batch(size_t maxFiles)
+{
+	if (maxFiles < 2)
+		return 0;
+
+	std::unique_lock<std::mutex> s(m_lk);
+
+	// Only checksummed files no destination has started or has in hand, with
+	// names that fit a ustar header; the rest go as they are. Offsets are
+	// only confirmed every second, so a file another destination is sending
+	// may not show one yet
+	auto untouched = [](const File& f) {
+		for (const auto& o : f.offset)
+			if (o.second)
+				return false;
+		return f.sent.empty() && f.claimed.empty();
+	};
+
+	std::vector<Entry> eligible;
+	for (const auto& f : m_files)
+		if (f.second.members.empty() && f.second.crc && untouched(f.second) && f.first.size() <= TarStream::MAX_NAME)
+			eligible.push_back(Entry{ f.first, f.second.size, f.second.crc, 0, {} });
+
+	size_t made = 0;
+	for (size_t first = 0; first + 2 <= eligible.size(); first += maxFiles)
+	{
+		File a;
+		a.members.assign(eligible.begin() + first, eligible.begin() + std::min(eligible.size(), first + maxFiles));
+		a.size = archiveOf(a.members)->size();
+		a.verified = true;
+		std::string name = BF::path(a.members.front().name).stem().stem().string() + "+" + std::to_string(a.members.size()) + BATCH_EXT;
+
+		// One journal line turns the members into the archive, so a crash
+		// leaves either the files or the archive to upload, never both
+		std::stringstream strm;
+		for (const Entry& m : a.members)
+		{
+			m_files.erase(m.name);
+			strm << (strm.tellp() > 0 ? " " : "") << std::quoted(m.name);
+		}
+		m_files[name] = a;
+		record("TAR", name, strm.str());
+
+		LOG(LL_Info, LC_Outbox, "Batched " << a.members.size() << " files as " << name << ", " << a.size << " bytes");
+		++made;
+	}
+
+	return made;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Logging/Log.h"
+#include "configuration.hxx"
+#include "TarStream.h"
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+// Closed record files waiting to be uploaded. Rotation moves each file into
+// LogPath/outbox and appends it to a journal together with its size and, per
+// destination, the remote offset the server has confirmed so far. Uploaders
+// work from the journal, so resuming after a restart or reconnect needs
+// neither a directory scan nor a remote stat per file. Offsets may also be
+// confirmed for the live file while it is streamed; they carry over when it
+// is added. A file is deleted once every required destination has it.
+//
+// The CRC32 of each file is taken by an uploader, not at rotation, so the
+// writer never reads a whole file back. A file already checksummed by an
+// earlier run is checked against it before resuming.
+//
+// Journal lines, replayed in order on startup. Names are quoted:
+//   ADD "<name>" <size>
+//   CRC "<name>" <crc32>
+//   TAR "<name>" "<member>"...  the members are uploaded as archive name
+//   OFFSET "<name>" <confirmed remote bytes> "<destination>"
+//   SENT "<name>" "<destination>"
+//   DONE "<name>"          every required destination has it; deleted
+//   DROP "<name>"          pruned before it could be uploaded
+class Outbox : public Logging::LogClient
+{
+public:
+	struct Entry
+	{
+		std::string name;
+		uint64_t size{0};
+		std::optional<uint32_t> crc;
+		uint64_t offset{0};
+		std::vector<Entry> members;  // an archive of these files, see batch()
+	};
+
+	Outbox(Logging::LogFile& log, const loggercfg::Logger& cfg);
+	~Outbox();
+
+	// Move a closed record file into the outbox
+	void add(const BF::path& file);
+
+	// Files dest still needs, oldest first, with dest's offsets. They are
+	// claimed by dest, and so left out of batch(), until release(dest)
+	std::vector<Entry> pending(const std::string& dest);
+	void release(const std::string& dest);
+
+	// Files waiting, counting those in an archive
+	size_t size() const;
+
+	BF::path path(const std::string& name) const { return m_dir / name; }
+
+	// The bytes to upload for e if it is an archive, otherwise null
+	std::unique_ptr<TarStream> archive(const Entry& e) const;
+
+	// Files this run has not yet checksummed
+	std::vector<std::string> unverified() const;
+
+	// Checksum name, or check it against its journalled CRC, restarting it
+	// from offset 0 if the file has changed. Reads the whole file; call from
+	// an uploader, never with the writer waiting
+	void verify(const std::string& name);
+
+	// dest holds the first offset bytes of name, which may be the live file
+	void confirm(const std::string& name, const std::string& dest, uint64_t offset);
+
+	// Confirmed offset of the live file name at dest
+	uint64_t liveOffset(const std::string& name, const std::string& dest) const;
+
+	// dest holds all of name. Deletes it once every required destination does
+	void sent(const std::string& name, const std::string& dest);
+
+	// Delete the oldest files until at most keep remain
+	void prune(size_t keep);
+
+	// Group checksummed files no destination has started or claimed into tar
+	// archives of up to maxFiles each, so an upload pays the per-file SFTP
+	// round trips once per archive. Nothing is copied: archive() makes the
+	// tar from the files as it is read. Each starts with an INDEX member
+	// listing "name size crc32" per file and unpacks with any tar. Returns
+	// the number of archives made
+	size_t batch(size_t maxFiles);
+
+private:
+	struct File
+	{
+		uint64_t size{0};
+		std::optional<uint32_t> crc;
+		bool verified{false};  // crc taken or checked by this run
+		std::vector<Entry> members;
+		std::map<std::string, uint64_t> offset;
+		std::set<std::string> sent;
+		std::set<std::string> claimed;  // destinations with it in hand
+	};
+
+	void load();
+	void adopt(const BF::path& file);
+	bool check(const std::string& name, File& f);
+	void takeLive(const std::string& name, File& f);
+	bool complete(const File& f) const;
+	void remove(const std::string& name, const char* op);
+	void record(const std::string& op, const std::string& name, const std::string& args = std::string());
+	void compact();
+	size_t files() const;
+	std::unique_ptr<TarStream> archiveOf(const std::vector<Entry>& members) const;
+
+	static uint32_t crc(const BF::path& file);
+
+	mutable std::mutex m_lk;
+	BF::path m_logPath;
+	BF::path m_dir;
+	BF::path m_journalPath;
+	FILE* m_journal{nullptr};
+	uint32_t m_records{0};
+
+	std::set<std::string> m_destinations;
+	std::set<std::string> m_required;
+
+	std::map<std::string, File> m_files;
+	std::map<std::string, std::map<std::string, uint64_t>> m_live;
+};
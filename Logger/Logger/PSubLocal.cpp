@@ -1,7 +1,10 @@
 #include "PSubLocal.h"
 #include "configuration.hxx"
+#include "Profiler.h"
+#include "Rotation.h"
 
 #include <stdint.h>
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 #include <string>
@@ -18,6 +21,17 @@ namespace Logging
 
 using namespace Logging;
 
+namespace
+{
+	// Durable latency resolution; bounds the bookkeeping between flushes
+	const auto UNFLUSHED_SLOT = std::chrono::milliseconds(100);
+
+	uint64_t usec(std::chrono::steady_clock::duration d)
+	{
+		return uint64_t(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+	}
+}
+
 PSubLocal::PSubLocal(Task::TaskMsgDispatcher& disp, Logging::LogFile& log, HubApps::HubCore& hub, const loggercfg::Logger& cfg, std::function<void()> onNewFile)
 	: Task::TTask<PSubLocal>(disp)
 	, Logging::LogClient(log)
@@ -25,6 +39,15 @@ PSubLocal::PSubLocal(Task::TaskMsgDispatcher& disp, Logging::LogFile& log, HubAp
 	, m_hub(hub.makeHandler(*this, hub.psubAddr()))
 {
 	cfg._copy(m_cfg);
+
+	if (m_cfg.FtpUpload_present())
+		m_outbox.reset(new Outbox(log, m_cfg));
+
+	if (m_cfg.TopK_present())
+	{
+		m_fileTop.reset(new SubjectTop(m_cfg.TopK().Capacity()));
+		m_runTop.reset(new SubjectTop(m_cfg.TopK().Capacity()));
+	}
 }
 
 template <> void PSubLocal::processEvent<NewfileEvt>(void)
@@ -36,7 +59,18 @@ template <> void PSubLocal::processEvent<NewfileEvt>(void)
 template <> void PSubLocal::processEvent<NewfileEvtSync>(void)
 {
 	std::unique_lock<std::mutex> s(m_lk);
-	initNewFile();
+
+	// The dispatcher waits for m_onNewFile before it rotates for another
+	// upload, so it is called even when rotation fails; the outbox still
+	// holds whatever was closed before
+	try
+	{
+		initNewFile();
+	}
+	catch (const std::exception& ex)
+	{
+		LOG(LL_Warning, LC_Local, "Unable to rotate for upload: " << ex.what());
+	}
 	m_onNewFile();
 	//m_disp.enqueue<Logger_Dispatcher::evNewFileCreated>();
 }
@@ -44,7 +78,127 @@ template <> void PSubLocal::processEvent<NewfileEvtSync>(void)
 template <> void PSubLocal::processEvent<PSubLocal::FlushEvt>(void)
 {
 	std::unique_lock<std::mutex> s(m_lk);
-	m_strm.flush();
+	if (!m_strm.good())
+		return;
+
+	// Through zlib to the file, so what has been recorded so far can be read back
+	Metrics::ScopeTimer timer(Metrics::FlushUs);
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	z_off_t off = Storage::flush(m_strm, m_fname, m_storage);
+	if (off >= 0)
+		m_liveOffset = uint64_t(off);
+	flushed(started);
+	Metrics::add(Metrics::Flushes);
+}
+
+template <> void PSubLocal::processEvent<PSubLocal::StreamEvt>(void)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+	if (!m_strm.good())
+		return;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	z_off_t off = m_strm.rdbuf()->syncflush();
+	if (off >= 0)
+		m_liveOffset = uint64_t(off);
+	flushed(started);
+}
+
+void PSubLocal::flushed(std::chrono::steady_clock::time_point started)
+{
+	auto now = std::chrono::steady_clock::now();
+	Histogram& h = Metrics::latency(Metrics::Durable);
+	uint64_t records = 0;
+	for (const auto& slot : m_unflushed)
+	{
+		h.record(usec(now - slot.first), slot.second);
+		records += slot.second;
+	}
+	m_unflushed.clear();
+	Trace::record(Trace::Flush, records, Trace::usSince(started));
+}
+
+bool PSubLocal::liveBoundary(std::string& fname, uint64_t& offset)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+	if (!m_strm.good() || m_fname.empty())
+		return false;
+
+	fname = m_fname;
+	offset = m_liveOffset;
+	return true;
+}
+
+SubjectTop::Table PSubLocal::topK()
+{
+	std::unique_lock<std::mutex> s(m_lk);
+	return m_runTop ? m_runTop->table(m_cfg.TopK().Size()) : SubjectTop::Table();
+}
+
+void PSubLocal::written(uint64_t& raw, uint64_t& compressed)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+	raw = m_strm.good() ? uint64_t(m_strm.rdbuf()->written()) : 0;
+	compressed = m_strm.good() ? uint64_t(m_strm.rdbuf()->compressed()) : 0;
+}
+
+template <> void PSubLocal::processEvent<PSubLocal::DrainEvt>(void)
+{
+	Profiler::tag(Profiler::RoleWriter);
+	drain();
+}
+
+void PSubLocal::drain()
+{
+	IngestQueue::Entry e;
+	while (m_queue.pop(e))
+	{
+		writeGap();
+		m_dequeued = std::chrono::steady_clock::now();
+		Metrics::latency(Metrics::Bus).record(usec(e.msg.age));
+		Metrics::latency(Metrics::Queue).record(usec(m_dequeued - e.received));
+		Trace::record(Trace::Dequeue, usec(m_dequeued - e.received), uint32_t(m_queue.depth()));
+
+		processMsg(std::move(e.msg));
+	}
+
+	// Drops with nothing queued after them, e.g. while stopping
+	writeGap();
+}
+
+void PSubLocal::writeGap()
+{
+	uint64_t msgs, bytes;
+	if (m_queue.takeGap(msgs, bytes))
+	{
+		LOG(LL_Warning, LC_Local, "Ingest queue overloaded. Dropped " << msgs << " messages, " << bytes << " bytes");
+		std::unique_lock<std::mutex> s(m_lk);
+		m_strm << "GAP " << msgs << " " << bytes << std::endl;
+	}
+}
+
+template <> void PSubLocal::processEvent<PSubLocal::SampleEvt>(void)
+{
+	std::unique_lock<std::mutex> s(m_lk);
+	m_sampler.expire(std::chrono::steady_clock::now(), [this](const PubSub::Message& m) { writeRecord(m); });
+}
+
+void PSubLocal::receiveEvent(PubSub::Message&& msg)
+{
+	Profiler::tag(Profiler::RoleHub);
+	Metrics::add(Metrics::MsgsReceived);
+	Metrics::add(Metrics::BytesReceived, msg.payload.size());
+
+	// Excluded subjects are dropped before they take up queue space
+	if (!m_filter.pass(msg.subject))
+		return;
+
+	size_t bytes = msg.payload.size();
+	if (m_queue.push(std::move(msg)))
+	{
+		Trace::record(Trace::Receive, bytes, uint32_t(m_queue.depth()));
+		enqueue<DrainEvt>();
+	}
 }
 
 void PSubLocal::eventBusConnected(HubApps::HubConnectionState state)
@@ -52,37 +206,45 @@ void PSubLocal::eventBusConnected(HubApps::HubConnectionState state)
 	if (state == HubApps::HubConnectionState::HubAvailable)
 	{
 		initNewFile();
-		m_hub->subscribe({ "*" });
+		for (const PubSub::Subject& sub : m_filter.subscriptions())
+			m_hub->subscribe(sub);
 	}
 }
 
-bool PSubLocal::initNewFile(void)
+void PSubLocal::closeFile()
 {
 	if (m_strm.good())
-		m_strm.close();
-
-	uint32_t fcnt = 0;
-	BF::path p(m_cfg.LogPath());
-	std::set<BF::path> dir;
-	std::string fnroot = m_cfg.FileNameRoot();
-	for (BF::directory_entry d : BF::directory_iterator(p))
 	{
-		std::string droot = d.path().filename().string().substr(0, fnroot.size());
-		if (droot == fnroot)
-		{
-			++fcnt;
-			dir.insert(d);
-		}
+		if (m_fileTop)
+			Rotation::trailer(m_strm, m_fileTop->table(m_cfg.TopK().Size()));
+
+		Metrics::add(Metrics::BytesWritten, uint64_t(m_strm.rdbuf()->written()));
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		Storage::close(m_strm, m_fname, m_storage);
+		flushed(started);
+
+		boost::system::error_code ec;
+		uintmax_t size = BF::file_size(m_fname, ec);
+		if (!ec)
+			Metrics::add(Metrics::BytesCompressed, size);
 	}
 
-	if (fcnt >= m_cfg.MaxFileCount())
-	{
-		for (uint32_t x = m_cfg.MaxFileCount(); x <= fcnt; ++x)
-		{
-			BF::remove(*dir.begin());
-			dir.erase(dir.begin());
-		}
-	}
+	if (m_fileTop)
+		m_fileTop->clear();
+
+	// Hand the closed file over for upload
+	if (m_outbox && !m_fname.empty())
+		m_outbox->add(m_fname);
+}
+
+bool PSubLocal::initNewFile(void)
+{
+	Metrics::ScopeTimer timer(Metrics::RotationUs);
+	Metrics::add(Metrics::Rotations);
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	closeFile();
+	Rotation::retain(m_cfg, m_outbox.get());
 
 	std::chrono::system_clock::time_point mk = std::chrono::system_clock::now();
 	std::chrono::system_clock::time_point nowsec = std::chrono::time_point_cast<std::chrono::seconds>(mk);
@@ -101,15 +263,39 @@ bool PSubLocal::initNewFile(void)
 		<< ".rec.gz";
 
 	m_fname = fname.str();
-	m_strm.open(m_fname.c_str());
-	if (m_strm.good())
+	if (Storage::open(m_strm, m_fname, m_storage))
 		m_strm << "START " << std::put_time(&t, "%Y%m%d%H%M%S") << "." << std::chrono::duration_cast<std::chrono::milliseconds>(mk - nowsec).count() << std::endl;
 
-	m_start_time = m_time_marker = std::chrono::steady_clock::now();
+	m_epoch = m_clock.now();
+	m_emitted = 0;
+	if (m_unit != std::chrono::milliseconds(1))
+		m_strm << "RES " << RecFormat::unitName(m_unit) << std::endl;
+	if (m_anchorEvery.count())
+		anchor();
+	m_encoder.reset();
+	m_liveOffset = 0;
 
 	m_flushMsg = enqueueWithDelay<FlushEvt>(std::chrono::seconds(m_flushSec), true);
+	Trace::record(Trace::Rotate, Trace::usSince(started));
 
 	LOG(LL_Info, LC_Local, "Created new log file " << m_fname);
+
+	for (const SubjectFilter::Pattern& p : m_filter.excludes())
+		if (p.dropped)
+			LOG(LL_Info, LC_Local, "Exclude \"" << p.text << "\" has dropped " << p.dropped << " messages");
+
+	for (const Sampler::Policy& p : m_sampler.policies())
+		if (p.dropped)
+			LOG(LL_Info, LC_Local, "Sample policy \"" << p.text << "\" has dropped " << p.dropped << " messages");
+
+	for (const RecEncoder::ChangeOnlyPolicy& p : m_encoder.changeOnly())
+		if (p.unchanged)
+			LOG(LL_Info, LC_Local, "Change only policy \"" << p.text << "\" has " << (p.skip ? "skipped " : "marked ") << p.unchanged << " unchanged messages");
+
+	for (const RecEncoder::DeltaPolicy& p : m_encoder.delta())
+		if (p.deltas)
+			LOG(LL_Info, LC_Local, "Delta policy \"" << p.text << "\" has encoded " << p.deltas << " messages, " << p.bytesIn << " bytes as " << p.bytesOut);
+
 	return m_strm.good();
 }
 
@@ -123,6 +309,29 @@ void PSubLocal::start()
 	// Store local copies of flush and new file counters
 	m_evtMax = m_cfg.NewFile_present() ? m_cfg.NewFile().Count() : loggercfg::NewFile::Count_default_value();
 	m_flushSec = m_cfg.Flush_present() ? m_cfg.Flush().IntervalS() : loggercfg::Flush::IntervalS_default_value();
+	m_streamSec = m_cfg.FtpUpload_present() ? m_cfg.FtpUpload().StreamS() : 0;
+	m_filter.configure(m_cfg);
+	m_queue.configure(m_cfg);
+	m_sampler.configure(m_cfg);
+	m_encoder.configure(m_cfg);
+	m_storage = Storage::Policy::fromConfig(m_cfg);
+
+	m_unit = std::chrono::milliseconds(1);
+	m_anchorEvery = std::chrono::seconds(0);
+	if (m_cfg.Timestamps_present())
+	{
+		if (!RecFormat::parseUnit(m_cfg.Timestamps().Resolution(), m_unit))
+			LOG(LL_Warning, LC_Local, "Unknown Timestamps Resolution \"" << m_cfg.Timestamps().Resolution() << "\", using ms");
+		m_anchorEvery = std::chrono::seconds(std::max(1u, m_cfg.Timestamps().AnchorS()));
+	}
+	m_clock.configure(m_cfg.Timestamps_present() ? m_cfg.Timestamps().Clock() : "steady", m_unit);
+	LOG(LL_Info, LC_Local, "Record times in " << RecFormat::unitName(m_unit) << " from the " << m_clock.name() << " clock");
+
+	if (m_sampler.tick().count() > 0)
+		m_sampleMsg = enqueueWithDelay<SampleEvt>(m_sampler.tick(), true);
+
+	if (m_streamSec)
+		m_streamMsg = enqueueWithDelay<StreamEvt>(std::chrono::seconds(m_streamSec), true);
 
 	//m_hub->stop();
 	m_hub->initSock();
@@ -132,68 +341,106 @@ void PSubLocal::stop()
 {
 	LOG(LL_Debug, LC_Local, "stop");
 
+	m_queue.close();
+	m_hub->stop();
+
+	// Write out what was queued before the close, and any GAP
+	drain();
+
 	std::unique_lock<std::mutex> s(m_lk);
 
-	m_hub->stop();
+	// Write out anything still held back by a keep-latest policy
+	m_sampleMsg.reset();
+	m_streamMsg.reset();
+	m_sampler.expire(std::chrono::steady_clock::time_point::max(), [this](const PubSub::Message& m) { writeRecord(m); });
 
-	if (m_strm.good())
-		m_strm.close();
+	closeFile();
+	m_fname.clear();
 
 	m_running = false;
 }
 
-#include <boost/archive/iterators/base64_from_binary.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
-
-using namespace boost::archive::iterators;
-
 void PSubLocal::processMsg(PubSub::Message&& m)
 {
-	std::string str;
-	LOG(LL_Debug, LC_Local, "Received msg " << PubSub::toString(m.subject, str));
 	std::unique_lock<std::mutex> s(m_lk);
 
-	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-	std::chrono::milliseconds tdiff1 = std::chrono::duration_cast<std::chrono::milliseconds>(m_time_marker - m_start_time);
-	std::chrono::milliseconds tdiff2 = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_start_time);
-	std::chrono::milliseconds tdiff3 = std::chrono::duration_cast<std::chrono::milliseconds>(tdiff2 - tdiff1);
-	m_time_marker = now;
+	if (!m_sampler.admit(m, std::chrono::steady_clock::now()))
+		return;
+
+	writeRecord(m, m_dequeued);
+}
 
-	//typedef transform_width< binary_from_base64<std::string::const_iterator>, 8, 6 > it_binary_t;
-	typedef base64_from_binary<transform_width<std::string::const_iterator, 6, 8> > it_base64_t;
+void PSubLocal::anchor()
+{
+	// Resynchronised first, so the counter's drift is bounded by AnchorS
+	m_clock.recalibrate();
+	m_epoch = m_clock.now();
+	std::chrono::system_clock::time_point wall = std::chrono::system_clock::now();
+	m_emitted = 0;
+	m_nextAnchor = m_epoch + m_anchorEvery;
+	m_strm << "TIME " << RecFormat::formatTime(wall) << std::endl;
+}
 
-	// Encode
-	unsigned int writePaddChars = (3 - m.payload.length() % 3) % 3;
-	std::string base64(it_base64_t(m.payload.begin()), it_base64_t(m.payload.end()));
-	base64.append(writePaddChars, '=');
+void PSubLocal::writeRecord(const PubSub::Message& m, std::chrono::steady_clock::time_point dequeued)
+{
+	std::chrono::steady_clock::time_point now = m_clock.now();
 
-	m_strm << tdiff3.count() << " " << m.age.count() << " " << m.ttl.count() << " ";
+	// Latency stamps come from m_clock as well unless it is the coarse clock,
+	// which would read the same tick before and after. Serialize and Compress
+	// go untimed then, and one steady_clock stamp serves the flush side
+	bool timed = m_clock.source() != FastClock::Coarse;
 
-	//for (uint32_t p : m.postmarks)
-	//	m_strm << p << " ";
-	for (std::vector<uint32_t>::size_type i = 0; i < m.postmarks.size(); ++i)
+	std::string field;
+	if (!m_encoder.encode(m, now, field))
+		return;
+
+	if (m_anchorEvery.count() && now >= m_nextAnchor)
 	{
-		m_strm << m.postmarks[i];
-		if (i + 1 < m.postmarks.size())
-			m_strm << ',';
+		anchor();
+		now = m_epoch;
 	}
 
-	m_strm << " " << PubSub::toString(m.subject) << " " << base64 << std::endl;
+	// Truncated from the epoch rather than the previous record so the sum
+	// does not drift. A recalibrated clock can step back a little; the
+	// record then takes the previous one's time
+	int64_t at = (now - m_epoch) / m_unit;
+	int64_t tdiff = std::max<int64_t>(0, at - m_emitted);
+	m_emitted += tdiff;
+
+	// Built in full before it goes to zlib so the two can be timed apart
+	m_line.clear();
+	RecFormat::format(m_line, tdiff, m, field);
+	std::chrono::steady_clock::time_point serialized;
+	if (timed)
+		serialized = m_clock.now();
+
+	m_strm.write(m_line.data(), m_line.size()) << std::endl;
+	std::chrono::steady_clock::time_point compressed = timed ? m_clock.now() : std::chrono::steady_clock::now();
+	Metrics::add(Metrics::MsgsWritten);
+
+	if (m_fileTop)
+	{
+		PubSub::toString(m.subject, m_subject);
+		m_fileTop->add(m_subject, m.payload.size());
+		m_runTop->add(m_subject, m.payload.size());
+	}
+
+	if (timed)
+	{
+		if (dequeued != std::chrono::steady_clock::time_point())
+			Metrics::latency(Metrics::Serialize).record(usec(serialized - dequeued));
+		Metrics::latency(Metrics::Compress).record(usec(compressed - serialized));
+	}
+	Trace::record(Trace::Write, m_line.size(), timed ? uint32_t(std::min<uint64_t>(usec(compressed - now), UINT32_MAX)) : 0);
+
+	if (m_unflushed.empty() || compressed - m_unflushed.back().first > UNFLUSHED_SLOT)
+		m_unflushed.emplace_back(compressed, 1);
+	else
+		++m_unflushed.back().second;
 
 	if (++m_evtCount >= m_evtMax)
 	{
 		initNewFile();
 		m_evtCount = 0;
 	}
-
-	//cout << "Base64 representation: " << base64 << endl;
-
-	//// Decode
-	//unsigned int paddChars = count(base64.begin(), base64.end(), '=');
-	//std::replace(base64.begin(), base64.end(), '=', 'A'); // replace '=' by base64 encoding of '\0'
-	//string result(it_binary_t(base64.begin()), it_binary_t(base64.end())); // decode
-	//result.erase(result.end() - paddChars, result.end());  // erase padding '\0' characters
-	//cout << "Decoded: " << result << endl;
-	//return 0;
 }
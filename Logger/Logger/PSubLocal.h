@@ -2,6 +2,16 @@
 
 #include "Logging/Log.h"
 #include "gzstream.h"
+#include "SubjectFilter.h"
+#include "Sampler.h"
+#include "RecFormat.h"
+#include "IngestQueue.h"
+#include "Outbox.h"
+#include "Metrics.h"
+#include "TopK.h"
+#include "Storage.h"
+#include "TraceRing.h"
+#include "FastClock.h"
 
 #include "Task/TTask.h"
 #include "HubApp/HubApp.h"
@@ -24,28 +34,63 @@ class PSubLocal : public Task::TTask<PSubLocal>, public Logging::LogClient
 {
 	//Logger_Dispatcher& m_disp;
 	loggercfg::Logger m_cfg;
-	std::function<void()>& m_onNewFile;
+	std::function<void()> m_onNewFile;
 
 	friend HubApps::HubHandler;
 	std::unique_ptr<HubApps::HubHandler> m_hub;
-	void receiveEvent(PubSub::Message&& msg) { /*hand off to thread queue*/enqueue<PubSub::Message&&>(std::move(msg)); }
+	void receiveEvent(PubSub::Message&& msg);
 	void receiveUnknown(uint8_t, const std::string&) {}
 	void eventBusConnected(HubApps::HubConnectionState state);
 
 	uint32_t m_evtCount{0};
 	uint32_t m_evtMax{1000000}; // Sane default but should be overridden by default config anyway
 	uint32_t m_flushSec{3600};  // As above
+	uint32_t m_streamSec{0};
+
+	SubjectFilter m_filter;
+	IngestQueue m_queue;
+	Sampler m_sampler;
+	RecEncoder m_encoder;
+	std::unique_ptr<Outbox> m_outbox;
+
+	// Heavy hitters among written subjects, for the current file's trailer and since start
+	std::unique_ptr<SubjectTop> m_fileTop;
+	std::unique_ptr<SubjectTop> m_runTop;
 
 	std::mutex m_lk;
+	Storage::Policy m_storage;
 	ogzstream m_strm{};
 	std::string m_fname;
-	std::chrono::steady_clock::time_point m_start_time;
-	std::chrono::steady_clock::time_point m_time_marker;
+
+	// Record times, from <Timestamps>. tdiffs count m_unit from m_epoch, the
+	// file start or the last TIME anchor, and m_emitted of them are written
+	FastClock m_clock;
+	std::chrono::nanoseconds m_unit{std::chrono::milliseconds(1)};
+	std::chrono::seconds m_anchorEvery{0};
+	std::chrono::steady_clock::time_point m_epoch;
+	std::chrono::steady_clock::time_point m_nextAnchor;
+	int64_t m_emitted{0};
 
 	bool m_running{false};
 	Task::MsgDelayMsgPtr m_flushMsg;
+	Task::MsgDelayMsgPtr m_sampleMsg;
+	Task::MsgDelayMsgPtr m_streamMsg;
+	uint64_t m_liveOffset{0};
+
+	// Latency bookkeeping. Records compressed but not yet flushed to the file
+	// are counted in slots by compression time
+	std::chrono::steady_clock::time_point m_dequeued;
+	std::deque<std::pair<std::chrono::steady_clock::time_point, uint32_t>> m_unflushed;
+	std::string m_line;
+	std::string m_subject;
 
 	bool initNewFile(void);
+	void closeFile();
+	void anchor();
+	void flushed(std::chrono::steady_clock::time_point started);
+	void drain();
+	void writeGap();
+	void writeRecord(const PubSub::Message& m, std::chrono::steady_clock::time_point dequeued = std::chrono::steady_clock::time_point());
 
 public:
 	explicit PSubLocal(Task::TaskMsgDispatcher&, Logging::LogFile&, HubApps::HubCore&, const loggercfg::Logger&, std::function<void()>);
@@ -54,8 +99,27 @@ public:
 	void stop();
 
 	const std::string& currentFileName() { return m_fname; }
+	const SubjectFilter& filter() const { return m_filter; }
+	const IngestQueue& queue() const { return m_queue; }
+	const Sampler& sampler() const { return m_sampler; }
+	const RecEncoder& encoder() const { return m_encoder; }
+	Outbox* outbox() { return m_outbox.get(); }
+
+	// Uncompressed and compressed bytes of the current file so far. Closed
+	// files are counted in Metrics::BytesWritten and BytesCompressed
+	void written(uint64_t& raw, uint64_t& compressed);
+
+	// Subjects written most since start. Empty unless TopK is configured
+	SubjectTop::Table topK();
+
+	// Current file and how much of it is decodable on disk. Advanced every
+	// FtpUpload/@StreamS seconds for streaming uploads
+	bool liveBoundary(std::string& fname, uint64_t& offset);
 
 	struct FlushEvt;
+	struct SampleEvt;
+	struct DrainEvt;
+	struct StreamEvt;
 	template <typename T> void processEvent(void);
 
 	void processMsg(PubSub::Message&& m);
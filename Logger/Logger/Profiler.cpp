@@ -0,0 +1,485 @@
+#include "Profiler.h"
+#include "XmlEscape.h"
+#include "pugixml/pugixml.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#include <cxxabi.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Logging
+{
+	const uint32_t LC_Profile = 0x4000;
+	template <> const char* getLCStr<LC_Profile  >() { return "Profile "; }
+}
+
+using namespace Logging;
+
+namespace
+{
+	const unsigned DEFAULT_SECONDS = 10;
+	const unsigned MAX_SECONDS = 600;
+
+	// Off the usual 100Hz tick so samples do not lock step with timers
+	const unsigned DEFAULT_HZ = 99;
+	const unsigned MAX_HZ = 1000;
+
+	// How often the sample rings are emptied. 16 pages hold about 200 deep
+	// samples, two seconds' worth at MAX_HZ
+	const auto DRAIN_INTERVAL = std::chrono::milliseconds(50);
+	const size_t RING_PAGES = 16;
+
+	// Lines of hottest code in the summary
+	const size_t TOP = 30;
+
+	std::mutex g_rolesLk;
+	std::map<long, uint32_t> g_roles;
+
+	const char* const ROLE_NAMES[] = { "hub", "dispatcher", "writer", "uploader", "exporter" };
+
+	long threadId()
+	{
+#ifdef __linux__
+		return long(syscall(SYS_gettid));
+#else
+		return 0;
+#endif
+	}
+
+	std::string roleNames(uint32_t roles)
+	{
+		std::string r;
+		for (size_t b = 0; b < sizeof(ROLE_NAMES) / sizeof(ROLE_NAMES[0]); ++b)
+			if (roles & (1u << b))
+				r += (r.empty() ? "" : ",") + std::string(ROLE_NAMES[b]);
+		return r.empty() ? "-" : r;
+	}
+
+#ifdef __linux__
+	struct Thread
+	{
+		long tid{0};
+		std::string name;
+		int sampler{-1};
+		int misses{-1};
+		void* ring{nullptr};
+		uint64_t samples{0};
+		uint64_t lost{0};
+		uint64_t voluntary{0};
+		uint64_t involuntary{0};
+	};
+
+	size_t pageSize()
+	{
+		return size_t(sysconf(_SC_PAGESIZE));
+	}
+
+	int perfOpen(perf_event_attr& attr, long tid)
+	{
+		return int(syscall(SYS_perf_event_open, &attr, pid_t(tid), -1, -1, PERF_FLAG_FD_CLOEXEC));
+	}
+
+	// User space only, which perf_event_paranoid allows up to 2
+	perf_event_attr counter(uint32_t type, uint64_t config)
+	{
+		perf_event_attr a;
+		memset(&a, 0, sizeof(a));
+		a.size = sizeof(a);
+		a.type = type;
+		a.config = config;
+		a.exclude_kernel = 1;
+		a.exclude_hv = 1;
+		a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return a;
+	}
+
+	// Scaled up if the kernel had to multiplex the counter. 0 if unavailable
+	uint64_t readCounter(int fd)
+	{
+		uint64_t v[3] = { 0, 0, 0 };  // value, time enabled, time running
+		if (fd < 0 || ::read(fd, v, sizeof(v)) != ssize_t(sizeof(v)))
+			return 0;
+		if (v[2] && v[2] < v[1])
+			return uint64_t(double(v[0]) * double(v[1]) / double(v[2]));
+		return v[0];
+	}
+
+	std::string readLine(const std::string& path)
+	{
+		std::ifstream f(path);
+		std::string line;
+		std::getline(f, line);
+		return line;
+	}
+
+	void switches(long tid, uint64_t& voluntary, uint64_t& involuntary)
+	{
+		std::ifstream f("/proc/self/task/" + std::to_string(tid) + "/status");
+		std::string line;
+		while (std::getline(f, line))
+		{
+			if (line.compare(0, 24, "voluntary_ctxt_switches:") == 0)
+				voluntary = strtoull(line.c_str() + 24, nullptr, 10);
+			else if (line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0)
+				involuntary = strtoull(line.c_str() + 27, nullptr, 10);
+		}
+	}
+
+	std::vector<long> threads()
+	{
+		std::vector<long> r;
+		if (DIR* d = opendir("/proc/self/task"))
+		{
+			while (dirent* e = readdir(d))
+				if (e->d_name[0] != '.')
+					r.push_back(strtol(e->d_name, nullptr, 10));
+			closedir(d);
+		}
+		std::sort(r.begin(), r.end());
+		return r;
+	}
+
+	// The function where the dynamic symbol table has it, else module+0xoff for addr2line
+	std::string symbolise(uint64_t ip)
+	{
+		std::ostringstream strm;
+		Dl_info info;
+		if (!dladdr(reinterpret_cast<void*>(ip), &info) || !info.dli_fname)
+			strm << "0x" << std::hex << ip;
+		else if (info.dli_sname)
+		{
+			int status = 0;
+			char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			strm << (status == 0 && demangled ? demangled : info.dli_sname);
+			free(demangled);
+		}
+		else
+		{
+			const char* slash = strrchr(info.dli_fname, '/');
+			strm << (slash ? slash + 1 : info.dli_fname) << "+0x" << std::hex << (ip - uint64_t(info.dli_fbase));
+		}
+		return strm.str();
+	}
+
+	// Empties a sample ring, writing each sample out and counting it into the
+	// totals: self for the leaf, total once per sample for every function on the chain
+	void drain(Thread& t, std::ostream& out, std::unordered_map<uint64_t, uint64_t>& self, std::unordered_map<uint64_t, uint64_t>& total)
+	{
+		perf_event_mmap_page* meta = static_cast<perf_event_mmap_page*>(t.ring);
+		const char* data = static_cast<const char*>(t.ring) + pageSize();
+		const uint64_t size = RING_PAGES * pageSize();
+
+		uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+		uint64_t tail = meta->data_tail;
+
+		// Records may wrap around the end of the ring
+		auto copy = [&](uint64_t pos, void* to, size_t len) {
+			size_t off = size_t(pos % size);
+			size_t first = std::min(len, size_t(size - off));
+			memcpy(to, data + off, first);
+			memcpy(static_cast<char*>(to) + first, data, len - first);
+		};
+
+		std::vector<uint64_t> rec;
+		std::vector<uint64_t> chain;
+		while (tail < head)
+		{
+			perf_event_header hdr;
+			copy(tail, &hdr, sizeof(hdr));
+			if (hdr.size < sizeof(hdr))
+				break;
+			rec.resize((hdr.size - sizeof(hdr) + 7) / 8);
+			copy(tail + sizeof(hdr), rec.data(), hdr.size - sizeof(hdr));
+			tail += hdr.size;
+
+			if (hdr.type == PERF_RECORD_LOST && rec.size() >= 2)
+				t.lost += rec[1];
+			if (hdr.type != PERF_RECORD_SAMPLE || rec.size() < 4)
+				continue;
+
+			// ip, pid and tid, time, callchain length and entries, as asked for in sample_type
+			uint64_t nr = std::min<uint64_t>(rec[3], rec.size() - 4);
+			chain.clear();
+			for (uint64_t i = 0; i < nr; ++i)
+				if (rec[4 + i] < PERF_CONTEXT_MAX)  // context markers are not addresses
+					chain.push_back(rec[4 + i]);
+			if (chain.empty())
+				chain.push_back(rec[0]);
+
+			++t.samples;
+			out << t.tid << " " << rec[2] << std::hex;
+			for (uint64_t ip : chain)
+				out << " " << ip;
+			out << std::dec << "\n";
+
+			++self[chain.front()];
+			std::sort(chain.begin(), chain.end());
+			chain.erase(std::unique(chain.begin(), chain.end()), chain.end());
+			for (uint64_t ip : chain)
+				++total[ip];
+		}
+
+		__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+	}
+
+	// Counts per function rather than per address, hottest first
+	std::vector<std::pair<uint64_t, std::string>> hottest(const std::unordered_map<uint64_t, uint64_t>& counts, std::unordered_map<uint64_t, std::string>& names)
+	{
+		std::map<std::string, uint64_t> byName;
+		for (const auto& c : counts)
+		{
+			auto n = names.find(c.first);
+			if (n == names.end())
+				n = names.emplace(c.first, symbolise(c.first)).first;
+			byName[n->second] += c.second;
+		}
+
+		std::vector<std::pair<uint64_t, std::string>> r;
+		for (const auto& n : byName)
+			r.emplace_back(n.second, n.first);
+		std::sort(r.begin(), r.end(), [](const auto& l, const auto& rt) { return l.first > rt.first; });
+		if (r.size() > TOP)
+			r.resize(TOP);
+		return r;
+	}
+#endif
+}
+
+void Profiler::addRole(Role r)
+{
+	std::unique_lock<std::mutex> s(g_rolesLk);
+	g_roles[threadId()] |= r;
+}
+
+Profiler::Profiler(Logging::LogFile& log, std::function<void(const std::string&)> status)
+	: Logging::LogClient(log)
+	, m_status(std::move(status))
+{
+}
+
+Profiler::~Profiler()
+{
+	{
+		std::unique_lock<std::mutex> s(m_lk);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool Profiler::start(const std::string& dir, const std::string& request)
+{
+	if (m_running.exchange(true))
+	{
+		LOG(LL_Warning, LC_Profile, "A profile is already running; request ignored");
+		return false;
+	}
+
+	unsigned seconds = DEFAULT_SECONDS;
+	unsigned hz = DEFAULT_HZ;
+	if (request.find_first_not_of(" \t\r\n") != std::string::npos)
+	{
+		pugi::xml_document doc;
+		pugi::xml_parse_result r = doc.load_string(request.c_str());
+		if (r.status != pugi::xml_parse_status::status_ok)
+			LOG(LL_Warning, LC_Profile, "Profile request is not XML; using the defaults");
+		pugi::xml_node p = doc.child("Profile");
+		seconds = p.attribute("DurationS").as_uint(DEFAULT_SECONDS);
+		hz = p.attribute("FrequencyHz").as_uint(DEFAULT_HZ);
+	}
+	seconds = std::max(1u, std::min(seconds, MAX_SECONDS));
+	hz = std::max(1u, std::min(hz, MAX_HZ));
+
+	// The previous profile has finished, its thread only needs collecting
+	if (m_thread.joinable())
+		m_thread.join();
+
+	int n = m_count++;
+	m_thread = std::thread([this, dir, seconds, hz, n]() {
+		run(dir, seconds, hz, n);
+		m_running = false;
+	});
+	return true;
+}
+
+void Profiler::run(const std::string& dir, unsigned seconds, unsigned hz, int n)
+{
+#ifndef __linux__
+	(void)dir; (void)seconds; (void)hz; (void)n;
+	LOG(LL_Warning, LC_Profile, "Profiling is only supported on Linux");
+	m_status("<Profile State=\"failed\" Error=\"not supported on this platform\"/>");
+#else
+	std::string base = dir + "/profile." + std::to_string(getpid()) + "." + std::to_string(n);
+	std::string summaryPath = base + ".txt";
+	std::string samplesPath = base + ".samples";
+
+	// Cycles where there is a PMU, the thread's CPU time otherwise
+	bool cycles = true;
+	std::vector<Thread> profiled;
+	std::string error;
+	long self = threadId();
+	for (long tid : threads())
+	{
+		if (tid == self)
+			continue;
+
+		Thread t;
+		t.tid = tid;
+		t.name = readLine("/proc/self/task/" + std::to_string(tid) + "/comm");
+
+		perf_event_attr a = counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		if (!cycles)
+			a = counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+		a.freq = 1;
+		a.sample_freq = hz;
+		a.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+		a.exclude_callchain_kernel = 1;
+		t.sampler = perfOpen(a, tid);
+		if (t.sampler < 0 && cycles && (errno == ENOENT || errno == EOPNOTSUPP || errno == ENODEV))
+		{
+			cycles = false;
+			a.type = PERF_TYPE_SOFTWARE;
+			a.config = PERF_COUNT_SW_TASK_CLOCK;
+			t.sampler = perfOpen(a, tid);
+		}
+		if (t.sampler < 0)
+		{
+			// Gone already is fine; anything else will fail every thread the same way
+			if (errno != ESRCH)
+				error = std::string("perf_event_open: ") + strerror(errno);
+			continue;
+		}
+
+		t.ring = mmap(nullptr, (1 + RING_PAGES) * pageSize(), PROT_READ | PROT_WRITE, MAP_SHARED, t.sampler, 0);
+		if (t.ring == MAP_FAILED)
+		{
+			error = std::string("mmap: ") + strerror(errno);
+			t.ring = nullptr;
+			close(t.sampler);
+			continue;
+		}
+
+		perf_event_attr m = counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		t.misses = perfOpen(m, tid);
+
+		switches(tid, t.voluntary, t.involuntary);
+		profiled.push_back(t);
+	}
+
+	if (profiled.empty())
+	{
+		LOG(LL_Warning, LC_Profile, "Cannot profile: " << (error.empty() ? "no threads" : error) << ". Check /proc/sys/kernel/perf_event_paranoid");
+		m_status("<Profile State=\"failed\" Error=\"" + xmlEscape(error) + "\"/>");
+		return;
+	}
+
+	LOG(LL_Info, LC_Profile, "Profiling " << profiled.size() << " threads for " << seconds << "s at " << hz << "Hz on " << (cycles ? "cycles" : "task-clock"));
+
+	std::ofstream samples(samplesPath);
+	samples << "# ccmloggerd profile. Each sample is: <tid> <time ns> <ip> [<caller ip>...], ips in hex leaf first\n"
+		<< "# MAP lines are /proc/self/maps, to resolve ips with addr2line\n";
+	{
+		std::ifstream maps("/proc/self/maps");
+		std::string line;
+		while (std::getline(maps, line))
+			samples << "MAP " << line << "\n";
+	}
+
+	std::unordered_map<uint64_t, uint64_t> selfCounts;
+	std::unordered_map<uint64_t, uint64_t> totalCounts;
+	auto started = std::chrono::steady_clock::now();
+	auto until = started + std::chrono::seconds(seconds);
+	{
+		std::unique_lock<std::mutex> s(m_lk);
+		while (!m_stop && std::chrono::steady_clock::now() < until)
+		{
+			m_cv.wait_for(s, DRAIN_INTERVAL);
+			for (Thread& t : profiled)
+				drain(t, samples, selfCounts, totalCounts);
+		}
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	for (Thread& t : profiled)
+	{
+		ioctl(t.sampler, PERF_EVENT_IOC_DISABLE, 0);
+		if (t.misses >= 0)
+			ioctl(t.misses, PERF_EVENT_IOC_DISABLE, 0);
+		drain(t, samples, selfCounts, totalCounts);
+	}
+	samples.close();
+
+	std::map<long, uint32_t> roles;
+	{
+		std::unique_lock<std::mutex> s(g_rolesLk);
+		roles = g_roles;
+	}
+
+	std::ofstream summary(summaryPath);
+	std::time_t now = std::time(nullptr);
+	tm t;
+	gmtime_r(&now, &t);
+	summary << "ccmloggerd profile " << n << ", " << std::fixed << std::setprecision(1) << elapsed << "s at " << hz << "Hz on "
+		<< (cycles ? "cycles" : "task-clock") << ", finished " << std::put_time(&t, "%Y-%m-%d %H:%M:%S") << " UTC\n"
+		<< "Samples: " << samplesPath << "\n\n";
+
+	summary << std::left << std::setw(8) << "Thread" << std::setw(17) << "Name" << std::setw(22) << "Roles" << std::right
+		<< std::setw(16) << (cycles ? "Cycles" : "TaskClockNs") << std::setw(14) << "CacheMisses"
+		<< std::setw(10) << "VolCS" << std::setw(10) << "InvolCS" << std::setw(9) << "Samples" << std::setw(7) << "Lost" << "\n";
+
+	uint64_t samplesTaken = 0;
+	for (Thread& th : profiled)
+	{
+		uint64_t voluntary = 0, involuntary = 0;
+		switches(th.tid, voluntary, involuntary);
+		auto r = roles.find(th.tid);
+
+		summary << std::left << std::setw(8) << th.tid << std::setw(17) << th.name << std::setw(22) << roleNames(r == roles.end() ? 0 : r->second) << std::right
+			<< std::setw(16) << readCounter(th.sampler) << std::setw(14);
+		if (th.misses >= 0)
+			summary << readCounter(th.misses);
+		else
+			summary << "-";
+		summary << std::setw(10) << (voluntary - std::min(voluntary, th.voluntary)) << std::setw(10) << (involuntary - std::min(involuntary, th.involuntary))
+			<< std::setw(9) << th.samples << std::setw(7) << th.lost << "\n";
+		samplesTaken += th.samples;
+
+		if (th.misses >= 0)
+			close(th.misses);
+		munmap(th.ring, (1 + RING_PAGES) * pageSize());
+		close(th.sampler);
+	}
+
+	std::unordered_map<uint64_t, std::string> names;
+	const char* titles[] = { "Hottest code, self", "Hottest code, with callees" };
+	const std::unordered_map<uint64_t, uint64_t>* counts[] = { &selfCounts, &totalCounts };
+	for (int i = 0; i < 2; ++i)
+	{
+		summary << "\n" << titles[i] << "\n" << std::setw(9) << "Samples" << std::setw(8) << "%" << "  Function\n";
+		for (const auto& h : hottest(*counts[i], names))
+			summary << std::setw(9) << h.first << std::setw(8) << std::setprecision(1) << (samplesTaken ? 100.0 * h.first / samplesTaken : 0.0) << "  " << h.second << "\n";
+	}
+	summary.close();
+
+	LOG(LL_Info, LC_Profile, "Profile of " << samplesTaken << " samples written to " << summaryPath);
+	m_status("<Profile State=\"complete\" Samples=\"" + std::to_string(samplesTaken) + "\" Summary=\"" + xmlEscape(summaryPath) + "\" Raw=\"" + xmlEscape(samplesPath) + "\"/>");
+#endif
+}
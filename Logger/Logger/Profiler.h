@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Logging/Log.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Profiles the daemon's own threads with perf_event_open on request, for
+// terminals where perf cannot be attached. For the requested time every
+// thread is counted for CPU cycles and cache misses, and sampled on cycles
+// with its user space call chain; context switches come from /proc. Then
+//   <dir>/profile.<pid>.<n>.txt      per thread counts and the hottest code
+//   <dir>/profile.<pid>.<n>.samples  every sample, with the memory map to symbolise them
+// are written and the outcome is reported through the status callback.
+// Call chains are only as deep as frame pointers allow, and threads started
+// while profiling are not covered. Where there is no cycles counter, as in
+// most VMs, samples are taken on task-clock instead. Linux only.
+class Profiler : public Logging::LogClient
+{
+public:
+	// What a thread has been seen doing, to name it in the summary
+	enum Role : uint32_t
+	{
+		RoleHub = 1,
+		RoleDispatcher = 2,
+		RoleWriter = 4,
+		RoleUploader = 8,
+		RoleExporter = 16
+	};
+
+	// Marks the calling thread as taking part in r. Cheap after the first call
+	static void tag(Role r)
+	{
+		thread_local uint32_t roles = 0;
+		if (!(roles & r))
+		{
+			roles |= r;
+			addRole(r);
+		}
+	}
+
+	Profiler(Logging::LogFile& log, std::function<void(const std::string&)> status);
+	~Profiler();
+
+	// request is <Profile DurationS="10" FrequencyHz="99"/>, or empty for
+	// those defaults. Files go to dir. false if a profile is already running
+	bool start(const std::string& dir, const std::string& request);
+
+private:
+	static void addRole(Role r);
+	void run(const std::string& dir, unsigned seconds, unsigned hz, int n);
+
+	std::function<void(const std::string&)> m_status;
+	std::atomic<bool> m_running{false};
+	int m_count{0};
+
+	std::mutex m_lk;
+	std::condition_variable m_cv;
+	bool m_stop{false};
+	std::thread m_thread;
+};
@@ -0,0 +1,337 @@
+#include "RecFormat.h"
+#include "DeltaCodec.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/archive/iterators/base64_from_binary.hpp>
+#include <boost/archive/iterators/binary_from_base64.hpp>
+#include <boost/archive/iterators/transform_width.hpp>
+
+using namespace boost::archive::iterators;
+
+std::string RecFormat::base64Encode(const std::string& s)
+{
+	typedef base64_from_binary<transform_width<std::string::const_iterator, 6, 8> > it_base64_t;
+
+	unsigned int writePaddChars = (3 - s.length() % 3) % 3;
+	std::string base64(it_base64_t(s.begin()), it_base64_t(s.end()));
+	base64.append(writePaddChars, '=');
+	return base64;
+}
+
+std::string RecFormat::base64Decode(const std::string& s)
+{
+	typedef transform_width<binary_from_base64<std::string::const_iterator>, 8, 6> it_binary_t;
+
+	std::string base64(s);
+	size_t paddChars = std::count(base64.begin(), base64.end(), '=');
+	std::replace(base64.begin(), base64.end(), '=', 'A'); // replace '=' by base64 encoding of '\0'
+	std::string result(it_binary_t(base64.begin()), it_binary_t(base64.end()));
+	result.erase(result.end() - std::min(paddChars, result.size()), result.end()); // erase padding '\0' characters
+	return result;
+}
+
+void RecFormat::format(std::string& line, int64_t tdiff, const PubSub::Message& m, const std::string& field)
+{
+	line += std::to_string(tdiff);
+	line += ' ';
+	line += std::to_string(m.age.count());
+	line += ' ';
+	line += std::to_string(m.ttl.count());
+	line += ' ';
+
+	for (std::vector<uint32_t>::size_type i = 0; i < m.postmarks.size(); ++i)
+	{
+		line += std::to_string(m.postmarks[i]);
+		if (i + 1 < m.postmarks.size())
+			line += ',';
+	}
+
+	line += ' ';
+	line += PubSub::toString(m.subject);
+	line += ' ';
+	line += field;
+}
+
+bool RecFormat::parseUnit(const std::string& name, std::chrono::nanoseconds& unit)
+{
+	if (name == "ms")
+		unit = std::chrono::milliseconds(1);
+	else if (name == "us")
+		unit = std::chrono::microseconds(1);
+	else if (name == "ns")
+		unit = std::chrono::nanoseconds(1);
+	else
+		return false;
+	return true;
+}
+
+const char* RecFormat::unitName(std::chrono::nanoseconds unit)
+{
+	return unit >= std::chrono::milliseconds(1) ? "ms" : unit >= std::chrono::microseconds(1) ? "us" : "ns";
+}
+
+std::string RecFormat::formatTime(std::chrono::system_clock::time_point t)
+{
+	std::chrono::system_clock::time_point sec = std::chrono::time_point_cast<std::chrono::seconds>(t);
+	if (sec > t)
+		sec -= std::chrono::seconds(1);
+
+	std::time_t tt = std::chrono::system_clock::to_time_t(sec);
+#if defined(WIN32)
+	tm tmv;
+	gmtime_s(&tmv, &tt);
+#else
+	tm tmv = *gmtime(&tt);
+#endif
+
+	std::ostringstream strm;
+	strm << std::put_time(&tmv, "%Y%m%d%H%M%S") << '.' << std::setw(9) << std::setfill('0')
+		<< std::chrono::duration_cast<std::chrono::nanoseconds>(t - sec).count();
+	return strm.str();
+}
+
+bool RecFormat::parseTime(const std::string& stamp, std::chrono::nanoseconds frac, int64_t& ns)
+{
+	int y, mo, d, h, mi, s;
+	long long f = 0;
+	int n = sscanf(stamp.c_str(), "%4d%2d%2d%2d%2d%2d.%lld", &y, &mo, &d, &h, &mi, &s, &f);
+	if (n < 6)
+		return false;
+
+	// Days since 1970-01-01 in the proleptic Gregorian calendar, without
+	// timegm, which Windows lacks
+	y -= mo <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	int64_t yoe = y - era * 400;
+	int64_t doy = (153 * (mo > 2 ? mo - 3 : mo + 9) + 2) / 5 + d - 1;
+	int64_t days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+
+	ns = ((days * 24 + h) * 60 + mi) * 60 + s;
+	ns = ns * 1000000000 + f * frac.count();
+	return true;
+}
+
+RecEncoder::ChangeOnlyPolicy::ChangeOnlyPolicy(const loggercfg::change_only_t& p)
+	: text(p.Subject())
+	, subject(PubSub::parseSubject(p.Subject()))
+	, skip(p.Skip())
+	, keyframe(std::chrono::seconds(p.KeyframeS()))
+{
+}
+
+RecEncoder::DeltaPolicy::DeltaPolicy(const loggercfg::delta_t& p)
+	: text(p.Subject())
+	, subject(PubSub::parseSubject(p.Subject()))
+	, keyframeN(p.KeyframeN())
+{
+}
+
+void RecEncoder::configure(const loggercfg::Logger& cfg)
+{
+	m_changeOnly.clear();
+	m_delta.clear();
+	m_state.clear();
+
+	if (cfg.ChangeOnly_present())
+		for (const loggercfg::change_only_t& p : cfg.ChangeOnly().Policy())
+			m_changeOnly.emplace_back(p);
+
+	if (cfg.Delta_present())
+		for (const loggercfg::delta_t& p : cfg.Delta().Policy())
+			m_delta.emplace_back(p);
+}
+
+namespace
+{
+	template <typename P> P* firstMatch(std::deque<P>& policies, const PubSub::Subject& s)
+	{
+		for (P& p : policies)
+			if (PubSub::match(p.subject, s))
+				return &p;
+
+		return nullptr;
+	}
+}
+
+bool RecEncoder::encode(const PubSub::Message& m, clock::time_point now, std::string& field)
+{
+	ChangeOnlyPolicy* c = firstMatch(m_changeOnly, m.subject);
+	DeltaPolicy* d = firstMatch(m_delta, m.subject);
+
+	if (!c && !d)
+	{
+		field = RecFormat::base64Encode(m.payload);
+		return true;
+	}
+
+	State& st = m_state[PubSub::toString(m.subject)];
+
+	if (c)
+	{
+		if (st.haveLast && st.last == m.payload && now - st.keyframe < c->keyframe)
+		{
+			c->unchanged.fetch_add(1, std::memory_order_relaxed);
+			if (c->skip)
+				return false;
+
+			field.assign(1, RecFormat::UNCHANGED);
+			return true;
+		}
+
+		st.keyframe = now;
+	}
+
+	if (d)
+	{
+		if (st.haveLast && st.sinceKey < d->keyframeN)
+		{
+			std::string delta = DeltaCodec::encode(st.last, m.payload);
+			if (delta.size() < m.payload.size())
+			{
+				d->deltas.fetch_add(1, std::memory_order_relaxed);
+				d->bytesIn.fetch_add(m.payload.size(), std::memory_order_relaxed);
+				d->bytesOut.fetch_add(delta.size(), std::memory_order_relaxed);
+
+				field.assign(1, RecFormat::DELTA);
+				field += RecFormat::base64Encode(delta);
+				st.last = m.payload;
+				++st.sinceKey;
+				return true;
+			}
+		}
+
+		st.sinceKey = 0;  // keyframe
+	}
+
+	st.haveLast = true;
+	st.last = m.payload;
+	field = RecFormat::base64Encode(m.payload);
+	return true;
+}
+
+bool RecReader::control(const std::string& line)
+{
+	if (line.compare(0, 6, "START ") == 0)
+	{
+		// Each file starts from a clean slate
+		m_start = line.substr(6);
+		m_last.clear();
+		m_top.clear();
+		m_unit = std::chrono::milliseconds(1);
+		if (!RecFormat::parseTime(m_start, std::chrono::milliseconds(1), m_time))
+			m_time = 0;
+	}
+	else if (line.compare(0, 4, "RES ") == 0)
+	{
+		if (!RecFormat::parseUnit(line.substr(4), m_unit))
+			++m_malformed;
+	}
+	else if (line.compare(0, 5, "TIME ") == 0)
+	{
+		if (!RecFormat::parseTime(line.substr(5), std::chrono::nanoseconds(1), m_time))
+			++m_malformed;
+	}
+	else if (line.compare(0, 4, "GAP ") == 0)
+	{
+		std::istringstream strm(line.substr(4));
+		uint64_t msgs = 0, bytes = 0;
+		strm >> msgs >> bytes;
+		m_gapMsgs += msgs;
+		m_gapBytes += bytes;
+		m_totalGapMsgs += msgs;
+	}
+	else if (line.compare(0, 4, "TOP ") == 0)
+	{
+		std::istringstream strm(line.substr(4));
+		Top t;
+		if (strm >> t.by >> t.count >> t.error >> t.subject)
+			m_top.push_back(t);
+	}
+
+	return true;
+}
+
+bool RecReader::next(Record& r)
+{
+	std::string line;
+	while (std::getline(m_in, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		if (line.empty())
+			continue;
+
+		if (line[0] >= 'A' && line[0] <= 'Z')
+		{
+			control(line);
+			continue;
+		}
+
+		// tdiff age ttl postmarks subject payload. Postmarks may be empty
+		std::string::size_type f[5];
+		std::string::size_type pos = 0;
+		int n = 0;
+		for (; n < 5; ++n)
+		{
+			pos = line.find(' ', pos);
+			if (pos == std::string::npos)
+				break;
+			f[n] = pos++;
+		}
+
+		if (n < 5)
+		{
+			++m_malformed;
+			continue;
+		}
+
+		try
+		{
+			r.tdiff = std::stoll(line.substr(0, f[0]));
+			r.age = std::stoll(line.substr(f[0] + 1, f[1] - f[0] - 1));
+			r.ttl = std::stoll(line.substr(f[1] + 1, f[2] - f[1] - 1));
+		}
+		catch (const std::exception&)
+		{
+			++m_malformed;
+			continue;
+		}
+
+		if (m_time)
+			m_time += r.tdiff * m_unit.count();
+		r.time = m_time;
+
+		r.postmarks = line.substr(f[2] + 1, f[3] - f[2] - 1);
+		r.subject = line.substr(f[3] + 1, f[4] - f[3] - 1);
+
+		std::string field = line.substr(f[4] + 1);
+		r.unchanged = !field.empty() && field[0] == RecFormat::UNCHANGED;
+		if (r.unchanged)
+			r.payload = m_last[r.subject];
+		else if (!field.empty() && field[0] == RecFormat::DELTA)
+		{
+			std::string& last = m_last[r.subject];
+			if (!DeltaCodec::decode(last, RecFormat::base64Decode(field.substr(1)), r.payload))
+			{
+				++m_malformed;
+				continue;
+			}
+			last = r.payload;
+		}
+		else
+			m_last[r.subject] = r.payload = RecFormat::base64Decode(field);
+
+		r.gapMsgs = m_gapMsgs;
+		r.gapBytes = m_gapBytes;
+		m_gapMsgs = m_gapBytes = 0;
+		return true;
+	}
+
+	return false;
+}
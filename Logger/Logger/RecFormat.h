@@ -0,0 +1,175 @@
+#pragma once
+
+#include "HubApp/HubApp.h"
+#include "configuration.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Record file format helpers.
+//
+// Each record is one line:
+//   <tdiff> <age> <ttl> <postmark,postmark...> <subject> <payload>
+// where tdiff is the time since the previous record, in milliseconds unless a
+// RES line says otherwise, and payload is the base64 encoded message or one of
+// the markers below. tdiffs are truncated against the last START or TIME line
+// rather than each other, so their sum does not drift from the true time.
+// Lines starting with an upper case keyword are control lines:
+//   START <yyyymmddhhmmss.ms>    first line of every file, UTC, milliseconds unpadded
+//   RES <ms|us|ns>               unit of tdiff for the rest of the file
+//   TIME <yyyymmddhhmmss.nnnnnnnnn>
+//                                UTC wall clock anchor, written with <Timestamps>
+//                                after START and every AnchorS; tdiff restarts from it
+//   GAP <messages> <bytes>       messages dropped by the ingest queue before the next record
+//   TOP <msgs|bytes> <count> <error> <subject>
+//                                trailer of the subjects written most in the file, highest
+//                                first; count may be over by up to error (see TopK.h)
+namespace RecFormat
+{
+	// Payload identical to the previous record on the same subject.
+	// Not a base64 character so cannot be confused with a payload
+	const char UNCHANGED = '~';
+
+	// Followed by a base64 DeltaCodec delta against the previous payload on the same subject
+	const char DELTA = '^';
+
+	std::string base64Encode(const std::string& s);
+	std::string base64Decode(const std::string& s);
+
+	// Appends the record line for m, without the newline, to line. field is the encoded payload
+	void format(std::string& line, int64_t tdiff, const PubSub::Message& m, const std::string& field);
+
+	// tdiff units by RES name. false if name is not one of ms, us or ns
+	bool parseUnit(const std::string& name, std::chrono::nanoseconds& unit);
+	const char* unitName(std::chrono::nanoseconds unit);
+
+	// The TIME stamp for t
+	std::string formatTime(std::chrono::system_clock::time_point t);
+
+	// A START or TIME stamp as ns since the Unix epoch. frac is the unit of
+	// the digits after the point: milliseconds for START, ns for TIME
+	bool parseTime(const std::string& stamp, std::chrono::nanoseconds frac, int64_t& ns);
+}
+
+// Writer side payload encoding.
+// <ChangeOnly> policies: byte identical payloads on a matching subject are
+// replaced by an UNCHANGED marker, or skipped entirely, until the keyframe
+// interval has elapsed.
+// <Delta> policies: payloads are written as a DELTA against the previous
+// payload on the same subject, with a full keyframe every KeyframeN records.
+class RecEncoder
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct ChangeOnlyPolicy
+	{
+		explicit ChangeOnlyPolicy(const loggercfg::change_only_t& p);
+
+		std::string text;
+		PubSub::Subject subject;
+		bool skip{false};          // drop repeats rather than writing a marker
+		clock::duration keyframe;  // write the full payload at least this often
+
+		std::atomic<uint64_t> unchanged{0};
+	};
+
+	struct DeltaPolicy
+	{
+		explicit DeltaPolicy(const loggercfg::delta_t& p);
+
+		std::string text;
+		PubSub::Subject subject;
+		uint32_t keyframeN;
+
+		std::atomic<uint64_t> deltas{0};
+		std::atomic<uint64_t> bytesIn{0};   // payload bytes delta encoded
+		std::atomic<uint64_t> bytesOut{0};  // resulting delta bytes
+	};
+
+	void configure(const loggercfg::Logger& cfg);
+
+	// Forget previous payloads so the next record on each subject is written in full
+	void reset() { m_state.clear(); }
+
+	// Sets field to the payload encoding. false if the record should not be written
+	bool encode(const PubSub::Message& m, clock::time_point now, std::string& field);
+
+	const std::deque<ChangeOnlyPolicy>& changeOnly() const { return m_changeOnly; }
+	const std::deque<DeltaPolicy>& delta() const { return m_delta; }
+
+private:
+	struct State
+	{
+		bool haveLast{false};
+		std::string last;             // last payload written, in full or as a delta
+		clock::time_point keyframe;   // change only: last written other than as UNCHANGED
+		uint32_t sinceKey{0};         // delta: deltas since the last keyframe
+	};
+
+	std::deque<ChangeOnlyPolicy> m_changeOnly;
+	std::deque<DeltaPolicy> m_delta;
+	std::unordered_map<std::string, State> m_state;
+};
+
+// Reads records back from a (decompressed) record stream, expanding markers
+// into the original payloads.
+class RecReader
+{
+public:
+	struct Record
+	{
+		int64_t tdiff{0};  // in unit()
+		int64_t time{0};   // ns since the Unix epoch, from the START and TIME lines; 0 if neither was read
+		int64_t age{0};
+		int64_t ttl{0};
+		std::string postmarks;
+		std::string subject;
+		std::string payload;
+		bool unchanged{false};
+
+		// Messages/bytes known to be missing immediately before this record
+		uint64_t gapMsgs{0};
+		uint64_t gapBytes{0};
+	};
+
+	explicit RecReader(std::istream& in) : m_in(in) {}
+
+	struct Top
+	{
+		std::string by;  // "msgs" or "bytes"
+		uint64_t count{0};
+		uint64_t error{0};
+		std::string subject;
+	};
+
+	// false at end of stream
+	bool next(Record& r);
+
+	const std::string& started() const { return m_start; }
+	std::chrono::nanoseconds unit() const { return m_unit; }
+
+	// The trailer of the file read, once the end is reached
+	const std::vector<Top>& top() const { return m_top; }
+	uint64_t malformed() const { return m_malformed; }
+	uint64_t gapMsgs() const { return m_totalGapMsgs; }
+
+private:
+	bool control(const std::string& line);
+
+	std::istream& m_in;
+	std::string m_start;
+	std::chrono::nanoseconds m_unit{std::chrono::milliseconds(1)};
+	int64_t m_time{0};
+	std::vector<Top> m_top;
+	uint64_t m_malformed{0};
+	uint64_t m_gapMsgs{0};
+	uint64_t m_gapBytes{0};
+	uint64_t m_totalGapMsgs{0};
+	std::unordered_map<std::string, std::string> m_last;
+};
@@ -0,0 +1,41 @@
+#include "Rotation.h"
+
+#include <set>
+
+void Rotation::trailer(std::ostream& strm, const SubjectTop::Table& t)
+{
+	for (const SpaceSaving::Entry& e : t.byMsgs)
+		strm << "TOP msgs " << e.count << " " << e.error << " " << e.key << "\n";
+	for (const SpaceSaving::Entry& e : t.byBytes)
+		strm << "TOP bytes " << e.count << " " << e.error << " " << e.key << "\n";
+}
+
+void Rotation::retain(const loggercfg::Logger& cfg, Outbox* outbox)
+{
+	uint32_t fcnt = 0;
+	BF::path p(cfg.LogPath());
+	std::set<BF::path> dir;
+	std::string fnroot = cfg.FileNameRoot();
+	for (BF::directory_entry d : BF::directory_iterator(p))
+	{
+		std::string droot = d.path().filename().string().substr(0, fnroot.size());
+		if (droot == fnroot && BF::is_regular_file(d.path()))
+		{
+			++fcnt;
+			dir.insert(d);
+		}
+	}
+
+	if (fcnt >= cfg.MaxFileCount())
+	{
+		for (uint32_t x = cfg.MaxFileCount(); x <= fcnt; ++x)
+		{
+			BF::remove(*dir.begin());
+			dir.erase(dir.begin());
+		}
+	}
+
+	// Files waiting in the outbox count towards MaxFileCount too
+	if (outbox)
+		outbox->prune(cfg.MaxFileCount() > dir.size() + 1 ? cfg.MaxFileCount() - dir.size() - 1 : 0);
+}
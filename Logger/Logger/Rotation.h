@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Outbox.h"
+#include "TopK.h"
+#include "configuration.hxx"
+
+#include <ostream>
+
+// The steps between one record file and the next, shared by
+// PSubLocal::initNewFile, Logger_Bench and Logger_StorageBench so the benches
+// time what ships. Closing goes through Storage::close and opening through
+// Storage::open.
+namespace Rotation
+{
+	// The TOP trailer for the file about to close, highest first
+	void trailer(std::ostream& strm, const SubjectTop::Table& t);
+
+	// Deletes the oldest record files in LogPath, then the oldest in the
+	// outbox, so that with the next file at most MaxFileCount remain
+	void retain(const loggercfg::Logger& cfg, Outbox* outbox);
+}
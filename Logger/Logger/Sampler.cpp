@@ -0,0 +1,128 @@
+#include "Sampler.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Least idle time before a subject's state is forgotten, and how often to look
+	const auto IDLE_AFTER = std::chrono::seconds(60);
+}
+
+Sampler::Policy::Policy(const loggercfg::sample_policy_t& p)
+	: text(p.Subject())
+	, subject(PubSub::parseSubject(p.Subject()))
+{
+	if (p.EveryN_present())
+		everyN = std::max(1u, p.EveryN());  // 0 would mean every 0th, and divide by it
+	if (p.MaxPerSec_present())
+		maxPerSec = p.MaxPerSec();
+	if (p.Burst_present())
+		burst = p.Burst();
+	if (p.LatestMs_present())
+		latest = std::chrono::milliseconds(p.LatestMs());
+
+	// Long enough for an empty bucket to fill and any held message to go
+	std::chrono::duration<double> refill(maxPerSec > 0.0 ? std::max(burst, 1.0) / maxPerSec : 0.0);
+	idle = std::max<clock::duration>({ IDLE_AFTER, latest, std::chrono::duration_cast<clock::duration>(refill) });
+}
+
+void Sampler::configure(const loggercfg::Logger& cfg)
+{
+	m_policies.clear();
+	m_tick = std::chrono::milliseconds(0);
+
+	if (!cfg.Sample_present())
+		return;
+
+	for (const loggercfg::sample_policy_t& p : cfg.Sample().Policy())
+	{
+		m_policies.emplace_back(p);
+
+		// Check held messages at least as often as the shortest interval
+		std::chrono::milliseconds l = m_policies.back().latest;
+		if (l.count() > 0 && (m_tick.count() == 0 || l < m_tick))
+			m_tick = l;
+	}
+}
+
+bool Sampler::admit(PubSub::Message& m, clock::time_point now)
+{
+	Policy* p = nullptr;
+	for (Policy& x : m_policies)
+		if (PubSub::match(x.subject, m.subject))
+		{
+			p = &x;
+			break;
+		}
+
+	if (!p || p->lossless())
+		return true;
+
+	if (now >= m_nextSweep)
+		sweep(now);
+
+	auto it = p->state.find(PubSub::toString(m.subject));
+	if (it == p->state.end())
+	{
+		it = p->state.emplace(PubSub::toString(m.subject), State()).first;
+		it->second.bucket.configure(p->maxPerSec, p->burst);
+	}
+	State& st = it->second;
+	st.last = now;
+
+	if (st.seen++ % p->everyN != 0 || !st.bucket.take(1.0, now))
+	{
+		p->dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	if (p->latest.count() > 0)
+	{
+		if (st.held)
+			p->dropped.fetch_add(1, std::memory_order_relaxed); // superseded before its interval ended
+		else
+			st.due = now + p->latest;
+
+		st.held = std::move(m);
+		return false;
+	}
+
+	return true;
+}
+
+void Sampler::expire(clock::time_point now, const std::function<void(const PubSub::Message&)>& write)
+{
+	for (Policy& p : m_policies)
+	{
+		if (p.latest.count() == 0)
+			continue;
+
+		for (auto& s : p.state)
+			if (s.second.held && s.second.due <= now)
+			{
+				write(*s.second.held);
+				s.second.held.reset();
+			}
+	}
+}
+
+void Sampler::sweep(clock::time_point now)
+{
+	m_nextSweep = now + IDLE_AFTER;
+
+	for (Policy& p : m_policies)
+		for (auto it = p.state.begin(); it != p.state.end();)
+			if (!it->second.held && now - it->second.last >= p.idle)
+				it = p.state.erase(it);
+			else
+				++it;
+}
+
+uint64_t Sampler::dropped() const
+{
+	uint64_t total = 0;
+	for (const Policy& p : m_policies)
+		total += p.dropped.load(std::memory_order_relaxed);
+
+	return total;
+}
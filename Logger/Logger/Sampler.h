@@ -0,0 +1,76 @@
+#pragma once
+
+#include "HubApp/HubApp.h"
+#include "TokenBucket.h"
+#include "configuration.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+
+// Per-subject sampling policies from the <Sample> config element. The first
+// policy whose pattern matches a subject applies; state is kept per distinct
+// subject so a wildcard pattern limits each matching subject separately.
+// A policy with no limits set keeps everything, which lets a specific lossless
+// pattern be listed ahead of a wildcard decimation.
+class Sampler
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct State
+	{
+		uint64_t seen{0};
+		TokenBucket bucket;
+		std::optional<PubSub::Message> held;
+		clock::time_point due;
+		clock::time_point last;  // last message on the subject
+	};
+
+	struct Policy
+	{
+		explicit Policy(const loggercfg::sample_policy_t& p);
+
+		bool lossless() const { return everyN <= 1 && maxPerSec <= 0.0 && latest.count() == 0; }
+
+		std::string text;
+		PubSub::Subject subject;
+		uint32_t everyN{1};                 // keep every Nth message
+		double maxPerSec{0.0};              // token bucket rate
+		double burst{1.0};                  // token bucket depth
+		std::chrono::milliseconds latest{0}; // keep only the latest message per interval
+		clock::duration idle;               // state unused this long is forgotten, see sweep()
+
+		std::atomic<uint64_t> dropped{0};
+		std::map<std::string, State> state;
+	};
+
+	void configure(const loggercfg::Logger& cfg);
+
+	// false if the message is dropped, or held to be written later by expire()
+	bool admit(PubSub::Message& m, clock::time_point now);
+
+	// Hand held messages whose interval has elapsed to write
+	void expire(clock::time_point now, const std::function<void(const PubSub::Message&)>& write);
+
+	// Interval at which expire() needs calling, zero if no policy holds messages
+	std::chrono::milliseconds tick() const { return m_tick; }
+
+	const std::deque<Policy>& policies() const { return m_policies; }
+	uint64_t dropped() const;
+
+private:
+	// Forget the state of subjects that have gone quiet, so subjects that
+	// come and go do not accumulate. Only once their bucket is full again
+	// and nothing is held, so forgetting changes no rate; an EveryN count
+	// restarts, keeping the next message
+	void sweep(clock::time_point now);
+
+	std::deque<Policy> m_policies;
+	std::chrono::milliseconds m_tick{0};
+	clock::time_point m_nextSweep;
+};
@@ -0,0 +1,250 @@
+#include "SftpSession.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#ifndef WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace Logging;
+
+namespace
+{
+	// libssh2_init is not thread safe and only needs doing once per process
+	struct Libssh2Init
+	{
+		int rc;
+		Libssh2Init() : rc(libssh2_init(0)) {}
+		~Libssh2Init() { if (!rc) libssh2_exit(); }
+	};
+
+	int libssh2Init()
+	{
+		static Libssh2Init init;
+		return init.rc;
+	}
+
+#ifdef WIN32
+	const SftpSession::socket_t NO_SOCKET = INVALID_SOCKET;
+#else
+	const SftpSession::socket_t NO_SOCKET = -1;
+#endif
+}
+
+SftpSession::SftpSession(Logging::LogFile& log, const Destination& dest, const loggercfg::FtpUpload& cfg)
+	: Logging::LogClient(log)
+	, m_host(dest.host)
+	, m_port(dest.port)
+	, m_username(dest.username)
+	, m_password(dest.password)
+	, m_keyfile(dest.keyfile)
+	, m_keepaliveS(cfg.KeepaliveS())
+	, m_maxBackoff(std::max(1u, cfg.MaxBackoffS()))
+	, m_sock(NO_SOCKET)
+	, m_nextAttempt(clock::now())
+{
+}
+
+SftpSession::~SftpSession()
+{
+	close();
+}
+
+LIBSSH2_SFTP* SftpSession::sftp()
+{
+	if (m_sftp)
+		return m_sftp;
+
+	if (clock::now() < m_nextAttempt)
+		return nullptr;
+
+	if (connect())
+		return m_sftp;
+
+	close();
+	backoff();
+	LOG(LL_Warning, LC_Upload, m_lastError << ". Next attempt in " << m_backoff.count() << "s");
+	return nullptr;
+}
+
+void SftpSession::backoff()
+{
+	m_backoff = std::min(m_maxBackoff, std::max(std::chrono::seconds(1), m_backoff * 2));
+	m_nextAttempt = clock::now() + m_backoff;
+}
+
+SftpSession::clock::duration SftpSession::retryIn() const
+{
+	return std::max(clock::duration(0), m_nextAttempt - clock::now());
+}
+
+bool SftpSession::fail(const std::string& why)
+{
+	m_lastError = why;
+	return false;
+}
+
+bool SftpSession::connect()
+{
+	auto start = clock::now();
+
+	if (int rc = libssh2Init())
+	{
+		std::stringstream strm; strm << "libssh2 initialization failed " << rc;
+		return fail(strm.str());
+	}
+
+	addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags |= AI_CANONNAME;
+
+	int errcode = getaddrinfo(m_host.c_str(), NULL, &hints, &res);
+	if (errcode != 0)
+	{
+		std::stringstream strm; strm << "getaddrinfo fail: " << errcode;
+		return fail(strm.str());
+	}
+
+	for (addrinfo* ai = res; ai && m_sock == NO_SOCKET; ai = ai->ai_next)
+	{
+		if (ai->ai_family != AF_INET)
+			continue;
+
+		socket_t sock = ::socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in sin = *((struct sockaddr_in *)ai->ai_addr);
+		sin.sin_port = htons(m_port);
+		if (::connect(sock, (struct sockaddr*)(&sin), sizeof(struct sockaddr_in)) == 0)
+			m_sock = sock;
+		else
+#ifdef WIN32
+			closesocket(sock);
+#else
+			::close(sock);
+#endif
+	}
+	freeaddrinfo(res);
+
+	if (m_sock == NO_SOCKET)
+	{
+		std::stringstream strm; strm << "Failed to connect to " << m_host << ":" << m_port;
+		return fail(strm.str());
+	}
+	auto connected = clock::now();
+
+	m_session = libssh2_session_init();
+	if (!m_session)
+		return fail("libssh2 session initialization failed");
+
+	libssh2_session_set_blocking(m_session, 1);
+	if (int rc = libssh2_session_handshake(m_session, m_sock))
+	{
+		std::stringstream strm; strm << "Failure establishing SSH session: " << rc;
+		return fail(strm.str());
+	}
+	auto handshaken = clock::now();
+
+	// With a key file the password, if any, is its passphrase
+	if (!m_keyfile.empty())
+	{
+		if (libssh2_userauth_publickey_fromfile(m_session, m_username.c_str(), nullptr, m_keyfile.c_str(), m_password.empty() ? nullptr : m_password.c_str()))
+			return fail("Authentication by key " + m_keyfile + " failed");
+	}
+	else if (libssh2_userauth_password(m_session, m_username.c_str(), m_password.c_str()))
+		return fail("Authentication by username/password failed");
+
+	m_sftp = libssh2_sftp_init(m_session);
+	if (!m_sftp)
+		return fail("Unable to init SFTP session");
+
+	if (m_keepaliveS)
+		libssh2_keepalive_config(m_session, 1, m_keepaliveS);
+
+	using std::chrono::duration_cast;
+	using std::chrono::milliseconds;
+	auto end = clock::now();
+	m_connectTime = duration_cast<milliseconds>(end - start);
+	m_tcpTime = duration_cast<milliseconds>(connected - start);
+	m_handshakeTime = duration_cast<milliseconds>(handshaken - connected);
+	++m_connects;
+	m_lastError.clear();
+
+	LOG(LL_Info, LC_Upload, "Connected to " << m_host << ":" << m_port << " in " << m_connectTime.count() << "ms"
+		<< " (tcp " << m_tcpTime.count() << "ms, handshake " << m_handshakeTime.count()
+		<< "ms, auth+sftp " << (m_connectTime - m_tcpTime - m_handshakeTime).count() << "ms)");
+	return true;
+}
+
+void SftpSession::waitSocket(std::chrono::milliseconds timeout)
+{
+	if (!m_session)
+		return;
+
+	fd_set rd, wr;
+	FD_ZERO(&rd);
+	FD_ZERO(&wr);
+
+	// Nothing reported blocked; only wake for incoming data such as acks
+	int dir = libssh2_session_block_directions(m_session);
+	if ((dir & LIBSSH2_SESSION_BLOCK_INBOUND) || !dir)
+		FD_SET(m_sock, &rd);
+	if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+		FD_SET(m_sock, &wr);
+
+	timeval tv;
+	tv.tv_sec = long(timeout.count() / 1000);
+	tv.tv_usec = long(timeout.count() % 1000) * 1000;
+	select(int(m_sock) + 1, &rd, &wr, nullptr, &tv);
+}
+
+void SftpSession::keepalive()
+{
+	if (!m_session || !m_keepaliveS)
+		return;
+
+	int next = 0;
+	libssh2_session_set_blocking(m_session, 1);
+	if (libssh2_keepalive_send(m_session, &next))
+		drop("Keepalive failed");
+}
+
+void SftpSession::drop(const std::string& why)
+{
+	if (!m_session)
+		return;
+
+	LOG(LL_Warning, LC_Upload, "Dropping SFTP session: " << why);
+	m_lastError = why;
+	close();
+	backoff();
+}
+
+void SftpSession::close()
+{
+	if (m_sftp)
+	{
+		libssh2_sftp_shutdown(m_sftp);
+		m_sftp = nullptr;
+	}
+	if (m_session)
+	{
+		libssh2_session_disconnect(m_session, "Normal Shutdown");
+		libssh2_session_free(m_session);
+		m_session = nullptr;
+	}
+	if (m_sock != NO_SOCKET)
+	{
+#ifdef WIN32
+		closesocket(m_sock);
+#else
+		::close(m_sock);
+#endif
+		m_sock = NO_SOCKET;
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Logging/Log.h"
+#include "configuration.hxx"
+#include "Destination.h"
+
+#include <chrono>
+#include <string>
+#if defined(WIN32)
+#include <winsock2.h>
+#include <libssh2/libssh2.h>
+#include <libssh2/libssh2_sftp.h>
+#else
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+#endif
+
+namespace Logging
+{
+	const uint32_t LC_Upload = 0x0800;
+}
+
+// Keeps one authenticated SFTP session open across uploads. The session is
+// kept alive with SSH keepalives and re-established on demand after an
+// error, backing off exponentially between failed connection attempts.
+// Not thread safe; owned and used by the upload thread only.
+class SftpSession : public Logging::LogClient
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+#ifdef WIN32
+	typedef SOCKET socket_t;
+#else
+	typedef int socket_t;
+#endif
+
+	SftpSession(Logging::LogFile& log, const Destination& dest, const loggercfg::FtpUpload& cfg);
+	~SftpSession();
+
+	// Connected SFTP channel, connecting first if needed. nullptr on failure or while backing off
+	LIBSSH2_SFTP* sftp();
+
+	LIBSSH2_SESSION* session() const { return m_session; }
+	socket_t socket() const { return m_sock; }
+	bool connected() const { return m_sftp != nullptr; }
+
+	// Wait until the socket is ready in the direction a non-blocking libssh2
+	// call was blocked on, or the timeout expires
+	void waitSocket(std::chrono::milliseconds timeout);
+
+	// Send a keepalive if one is due. Drops the session if the server has gone
+	void keepalive();
+
+	// Tear the session down after an error. The next sftp() reconnects after backing off
+	void drop(const std::string& why);
+
+	// A transfer went through; forget earlier failures
+	void succeeded() { m_backoff = std::chrono::seconds(0); }
+
+	// Time until the next connection attempt is allowed
+	clock::duration retryIn() const;
+
+	const std::string& lastError() const { return m_lastError; }
+
+	// Cost of the most recent connect (TCP + handshake + auth + SFTP init)
+	std::chrono::milliseconds connectTime() const { return m_connectTime; }
+	// Its TCP connect and SSH handshake; the rest is auth and SFTP init
+	std::chrono::milliseconds tcpTime() const { return m_tcpTime; }
+	std::chrono::milliseconds handshakeTime() const { return m_handshakeTime; }
+	uint32_t connects() const { return m_connects; }
+
+private:
+	bool connect();
+	void close();
+	bool fail(const std::string& why);
+	void backoff();
+
+	std::string m_host;
+	uint16_t m_port;
+	std::string m_username;
+	std::string m_password;
+	std::string m_keyfile;
+	uint32_t m_keepaliveS;
+	std::chrono::seconds m_maxBackoff;
+
+	socket_t m_sock;
+	LIBSSH2_SESSION* m_session{nullptr};
+	LIBSSH2_SFTP* m_sftp{nullptr};
+
+	clock::time_point m_nextAttempt;
+	std::chrono::seconds m_backoff{0};
+	std::string m_lastError;
+	std::chrono::milliseconds m_connectTime{0};
+	std::chrono::milliseconds m_tcpTime{0};
+	std::chrono::milliseconds m_handshakeTime{0};
+	uint32_t m_connects{0};
+};
@@ -0,0 +1,200 @@
+#define fopen_s(FD, FPATH, FLAGS) *FD = fopen(FPATH, FLAGS);
+
+#include "SftpTransfer.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+	// libssh2 splits a large write into many SFTP write requests and sends them
+	// all before waiting for the acks, so the buffer size bounds how much is in
+	// flight per file
+	const size_t BUFF_SIZE = 1024 * 1024;
+}
+
+SftpTransfer::SftpTransfer(SftpSession& session, Shaper& shaper, const BF::path& local, const std::string& remote, uint64_t offset, uint64_t end, std::unique_ptr<TarStream> tar)
+	: m_session(session)
+	, m_shaper(shaper)
+	, m_local(local)
+	, m_remote(remote)
+	, m_offset(offset)
+	, m_end(end)
+	, m_tar(std::move(tar))
+	, m_buff(BUFF_SIZE)
+{
+}
+
+SftpTransfer::~SftpTransfer()
+{
+	if (m_file)
+		fclose(m_file);
+
+	// Abandoned mid transfer
+	if (m_handle && m_session.connected())
+	{
+		LIBSSH2_SESSION* session = m_session.session();
+		int blocking = libssh2_session_get_blocking(session);
+		libssh2_session_set_blocking(session, 1);
+		libssh2_sftp_close(m_handle);
+		libssh2_session_set_blocking(session, blocking);
+	}
+}
+
+void SftpTransfer::fail(int rc, const std::string& what)
+{
+	std::stringstream strm;
+	strm << what << " " << m_remote << ": ";
+
+	char* errmsg = nullptr;
+	libssh2_session_last_error(m_session.session(), &errmsg, nullptr, 0);
+	if (rc == LIBSSH2_ERROR_SFTP_PROTOCOL)
+		strm << "SFTP error " << libssh2_sftp_last_error(m_session.sftp());
+	else
+		strm << (errmsg ? errmsg : "error") << " " << rc;
+	m_error = strm.str();
+
+	// The server refusing one file leaves the session usable, anything else does not
+	if (rc == LIBSSH2_ERROR_SFTP_PROTOCOL)
+	{
+		m_result = Status::Failed;
+		m_state = m_handle ? State::Close : State::Finished;
+	}
+	else
+	{
+		m_result = Status::SessionLost;
+		m_state = State::Finished;
+	}
+}
+
+SftpTransfer::Status SftpTransfer::step()
+{
+	for (;;)
+	{
+		switch (m_state)
+		{
+		case State::Open:
+			m_handle = libssh2_sftp_open(m_session.sftp(), m_remote.c_str(),
+										 LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | (m_offset ? 0 : LIBSSH2_FXF_TRUNC),
+										 LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
+										 LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH);
+			if (!m_handle)
+			{
+				int rc = libssh2_session_last_errno(m_session.session());
+				if (rc == LIBSSH2_ERROR_EAGAIN)
+					return Status::Blocked;
+				fail(rc, "Unable to open");
+				break;
+			}
+			m_state = State::Seek;
+			break;
+
+		case State::Seek:
+		{
+			boost::system::error_code ec;
+			uint64_t size = m_tar ? m_tar->size() : BF::file_size(m_local, ec);
+			if (!m_tar)
+				fopen_s(&m_file, m_local.string().c_str(), "rb");
+			if (ec || (!m_file && !m_tar))
+			{
+				m_error = "Unable to open " + m_local.string();
+				m_result = Status::Failed;
+				m_state = State::Close;
+				break;
+			}
+			m_end = std::min(m_end, size);
+			if (m_offset > m_end)
+			{
+				m_error = "Confirmed offset beyond the end of " + m_local.string();
+				m_result = Status::Failed;
+				m_state = State::Close;
+				break;
+			}
+
+			// Resume from the offset the server last confirmed. 64 bit, as
+			// long is 32 bit on Windows and files may pass 2GB
+#if defined(WIN32)
+			bool seeked = m_tar ? m_tar->seek(m_offset) : _fseeki64(m_file, int64_t(m_offset), SEEK_SET) == 0;
+#else
+			bool seeked = m_tar ? m_tar->seek(m_offset) : fseeko(m_file, off_t(m_offset), SEEK_SET) == 0;
+#endif
+			if (!seeked)
+			{
+				m_error = "Seek failed " + m_local.string();
+				m_result = Status::Failed;
+				m_state = State::Close;
+				break;
+			}
+			libssh2_sftp_seek64(m_handle, m_offset);
+			m_state = State::Write;
+			break;
+		}
+
+		case State::Write:
+		{
+			if (m_off == m_len)
+			{
+				if (m_eof)
+				{
+					m_result = Status::Done;
+					m_state = State::Close;
+					break;
+				}
+
+				size_t want = size_t(std::min<uint64_t>(m_buff.size(), m_end - m_offset - m_sent));
+				m_off = 0;
+				if (!want)
+					m_len = 0;
+				else
+					m_len = m_tar ? m_tar->read(m_buff.data(), want) : fread(m_buff.data(), 1, want, m_file);
+				if (m_len < m_buff.size())
+				{
+					m_eof = true;
+					if (m_tar ? m_tar->failed() : ferror(m_file) != 0)
+					{
+						m_error = "Read failed " + m_local.string();
+						m_result = Status::Failed;
+						m_state = State::Close;
+					}
+				}
+				break;
+			}
+
+			size_t n = m_shaper.grant(m_len - m_off);
+			if (!n)
+				return Status::Blocked;
+
+			ssize_t rc = libssh2_sftp_write(m_handle, m_buff.data() + m_off, n);
+			if (rc == LIBSSH2_ERROR_EAGAIN || rc == 0)
+				return Status::Blocked;
+			if (rc < 0)
+			{
+				fail(int(rc), "Write failed");
+				break;
+			}
+			m_shaper.consumed(rc);
+			m_off += rc;
+			m_sent += rc;
+			break;
+		}
+
+		case State::Close:
+		{
+			int rc = libssh2_sftp_close(m_handle);
+			if (rc == LIBSSH2_ERROR_EAGAIN)
+				return Status::Blocked;
+			m_handle = nullptr;
+			if (rc && m_result == Status::Done)
+			{
+				fail(rc, "Close failed");
+				break;
+			}
+			m_state = State::Finished;
+			break;
+		}
+
+		case State::Finished:
+			return m_result;
+		}
+	}
+}
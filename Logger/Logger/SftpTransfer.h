@@ -0,0 +1,68 @@
+#pragma once
+
+#include "SftpSession.h"
+#include "Shaper.h"
+#include "TarStream.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One local file being appended to its remote copy over a non-blocking SFTP
+// handle, starting at the offset the server has already confirmed and
+// stopping at end, or the end of the local file if that comes first. step()
+// advances the transfer as far as it can without blocking, so any number of
+// transfers can share one session and one thread. Writes are sized to what
+// the shared Shaper grants. Given a TarStream, that is sent in place of the
+// local file, which then only names the transfer.
+class SftpTransfer
+{
+public:
+	enum class Status
+	{
+		Blocked,		// waiting on the socket or the shaper
+		Done,			// remote copy complete and closed
+		Failed,			// this file failed, the session is still usable
+		SessionLost		// the session is unusable
+	};
+
+	SftpTransfer(SftpSession& session, Shaper& shaper, const BF::path& local, const std::string& remote, uint64_t offset, uint64_t end = UINT64_MAX, std::unique_ptr<TarStream> tar = nullptr);
+	~SftpTransfer();
+
+	Status step();
+
+	const BF::path& local() const { return m_local; }
+	const std::string& remote() const { return m_remote; }
+	uint64_t sent() const { return m_sent; }
+
+	// Remote bytes confirmed written
+	uint64_t offset() const { return m_offset + m_sent; }
+	const std::string& error() const { return m_error; }
+
+private:
+	enum class State { Open, Seek, Write, Close, Finished };
+
+	void fail(int rc, const std::string& what);
+
+	SftpSession& m_session;
+	Shaper& m_shaper;
+	BF::path m_local;
+	std::string m_remote;
+	uint64_t m_offset;
+	uint64_t m_end;
+
+	State m_state{State::Open};
+	Status m_result{Status::Done};
+	LIBSSH2_SFTP_HANDLE* m_handle{nullptr};
+	FILE* m_file{nullptr};
+	std::unique_ptr<TarStream> m_tar;
+
+	std::vector<char> m_buff;
+	size_t m_off{0};
+	size_t m_len{0};
+	bool m_eof{false};
+
+	uint64_t m_sent{0};
+	std::string m_error;
+};
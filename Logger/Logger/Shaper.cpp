@@ -0,0 +1,117 @@
+#include "Shaper.h"
+
+#include <algorithm>
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+using namespace Logging;
+
+namespace
+{
+	const auto SAMPLE_INTERVAL = std::chrono::milliseconds(500);
+
+	// RTT above base * RTT_RISE + RTT_SLACK_MS counts as congestion
+	const double RTT_RISE = 1.5;
+	const double RTT_SLACK_MS = 2.0;
+
+	// Lets the base RTT follow a genuine route change, about 6% a minute
+	const double BASE_DRIFT = 1.0005;
+
+	const double DECREASE = 0.7;
+	const double INCREASE_FRACTION = 0.05;
+	const double MIN_FRACTION = 1.0 / 32;
+}
+
+void Shaper::configure(const loggercfg::FtpUpload& cfg)
+{
+	std::unique_lock<std::mutex> lk(m_lk);
+	m_maxRate = cfg.RateBps();
+	m_minRate = std::max(double(QUANTUM), m_maxRate * MIN_FRACTION);
+
+	// Default burst is one second's worth, never less than one write
+	double burst = cfg.BurstBytes() ? cfg.BurstBytes() : m_maxRate;
+	m_bucket.configure(m_maxRate, std::max(burst, double(QUANTUM)));
+
+	m_adaptive = cfg.Adaptive() && m_maxRate > 0.0;
+	m_paths.clear();
+
+	if (cfg.Adaptive() && !m_adaptive)
+		LOG(LL_Warning, LC_Upload, "Adaptive upload shaping needs RateBps; running unlimited");
+#ifndef __linux__
+	if (m_adaptive)
+	{
+		LOG(LL_Warning, LC_Upload, "Adaptive upload shaping is not supported on this platform; using a fixed rate");
+		m_adaptive = false;
+	}
+#endif
+
+	if (limited())
+		LOG(LL_Info, LC_Upload, "Upload rate limited to " << m_maxRate << " B/s, burst " << std::max(burst, double(QUANTUM)) << (m_adaptive ? ", adaptive" : ""));
+}
+
+size_t Shaper::grant(size_t want, clock::time_point now)
+{
+	if (!limited())
+		return want;
+
+	std::unique_lock<std::mutex> lk(m_lk);
+	double avail = m_bucket.available(now);
+	if (avail < double(std::min(want, QUANTUM)))
+		return 0;
+
+	return std::min(want, size_t(avail));
+}
+
+void Shaper::consumed(size_t n, clock::time_point now)
+{
+	// Charged in full even if more than was granted, so the average rate holds
+	std::unique_lock<std::mutex> lk(m_lk);
+	m_bucket.debit(double(n), now);
+}
+
+Shaper::clock::duration Shaper::wait(clock::time_point now)
+{
+	std::unique_lock<std::mutex> lk(m_lk);
+	return m_bucket.wait(double(QUANTUM), now);
+}
+
+void Shaper::sample(const std::string& dest, SftpSession::socket_t sock, clock::time_point now)
+{
+	if (!m_adaptive)
+		return;
+
+#ifdef __linux__
+	// Each destination against its own base, as their RTTs differ
+	std::unique_lock<std::mutex> lk(m_lk);
+	Path& path = m_paths[dest];
+	if (now - path.lastSample < SAMPLE_INTERVAL)
+		return;
+	path.lastSample = now;
+
+	tcp_info ti;
+	socklen_t len = sizeof(ti);
+	if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &ti, &len) || !ti.tcpi_rtt)
+		return;
+
+	double rtt = ti.tcpi_rtt / 1000.0;
+	path.baseRtt = path.baseRtt > 0.0 ? std::min(path.baseRtt * BASE_DRIFT, rtt) : rtt;
+
+	double rate = m_bucket.rate();
+	if (rtt > path.baseRtt * RTT_RISE + RTT_SLACK_MS)
+		rate = std::max(m_minRate, rate * DECREASE);
+	else
+		rate = std::min(m_maxRate, rate + m_maxRate * INCREASE_FRACTION);
+
+	if (rate != m_bucket.rate())
+	{
+		LOG(LL_Debug, LC_Upload, "Upload rate " << rate << " B/s, rtt " << rtt << "ms, base " << path.baseRtt << "ms");
+		m_bucket.setRate(rate, now);
+	}
+#else
+	(void)dest;
+	(void)sock;
+#endif
+}
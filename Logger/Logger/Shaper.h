@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Logging/Log.h"
+#include "configuration.hxx"
+#include "SftpSession.h"
+#include "TokenBucket.h"
+
+#include <map>
+#include <mutex>
+
+// Limits the combined rate of all transfers to all destinations; one is
+// shared by every uploader thread. In adaptive mode the rate follows each
+// connection's smoothed RTT: it is cut when any RTT climbs well above the
+// lowest seen on that connection, meaning a queue is building on the uplink,
+// and grows back towards the configured rate otherwise.
+class Shaper : public Logging::LogClient
+{
+public:
+	typedef TokenBucket::clock clock;
+
+	// Smallest write worth waiting for tokens for. About one SFTP write request
+	static constexpr size_t QUANTUM = 32768;
+
+	explicit Shaper(Logging::LogFile& log) : Logging::LogClient(log) {}
+
+	void configure(const loggercfg::FtpUpload& cfg);
+
+	bool limited() const { return !m_bucket.unlimited(); }
+	double rate() const { std::unique_lock<std::mutex> lk(m_lk); return m_bucket.rate(); }
+
+	// Bytes that may be written now, up to want. Zero if fewer than
+	// min(want, QUANTUM) are available
+	size_t grant(size_t want, clock::time_point now = clock::now());
+
+	// Account for bytes actually written. Any overdraft delays the next grant
+	void consumed(size_t n, clock::time_point now = clock::now());
+
+	// Time until a full quantum is available
+	clock::duration wait(clock::time_point now = clock::now());
+
+	// Feed an RTT sample from the session socket of destination dest, which
+	// is compared with the lowest RTT seen for dest. Rate limited internally
+	void sample(const std::string& dest, SftpSession::socket_t sock, clock::time_point now = clock::now());
+
+private:
+	struct Path
+	{
+		double baseRtt{0.0};
+		clock::time_point lastSample;
+	};
+
+	mutable std::mutex m_lk;
+	TokenBucket m_bucket;
+	double m_maxRate{0.0};
+	double m_minRate{0.0};
+
+	bool m_adaptive{false};
+	std::map<std::string, Path> m_paths;
+};
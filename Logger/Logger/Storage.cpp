@@ -0,0 +1,109 @@
+#include "Storage.h"
+
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#if defined(WIN32)
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Through another descriptor, as zlib does not expose its own; both
+	// apply to the same file. Written back first when dropping, since only
+	// clean pages can be dropped
+	void settle(const std::string& fname, bool sync, bool drop)
+	{
+		if (!sync && !drop)
+			return;
+#if defined(WIN32)
+		(void)drop;
+		int fd = _open(fname.c_str(), _O_WRONLY);
+		if (fd < 0)
+			return;
+		_commit(fd);
+		_close(fd);
+#else
+		int fd = ::open(fname.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+#if defined(__linux__)
+		fdatasync(fd);
+		if (drop)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+		fsync(fd);
+#endif
+		::close(fd);
+#endif
+	}
+}
+
+Storage::Policy Storage::Policy::fromConfig(const loggercfg::Logger& cfg)
+{
+	Policy p;
+	if (cfg.Storage_present())
+	{
+		p.bufferBytes = cfg.Storage().BufferBytes();
+		p.level = int(std::min(9u, cfg.Storage().Level()));
+		p.fsync = cfg.Storage().Fsync();
+		p.dropCache = cfg.Storage().DropCache();
+	}
+	return p;
+}
+
+bool Storage::open(ogzstream& strm, const std::string& fname, const Policy& p)
+{
+	strm.rdbuf()->setparams(p.level, p.bufferBytes);
+	strm.open(fname.c_str());
+	return strm.good();
+}
+
+z_off_t Storage::flush(ogzstream& strm, const std::string& fname, const Policy& p)
+{
+	z_off_t off = strm.rdbuf()->syncflush();
+	if (off >= 0)
+		settle(fname, p.fsync, false);
+	return off;
+}
+
+void Storage::close(ogzstream& strm, const std::string& fname, const Policy& p)
+{
+	strm.close();
+	settle(fname, p.fsync, p.dropCache);
+}
+
+uint64_t Storage::cached(const std::string& fname)
+{
+#if defined(__linux__)
+	int fd = ::open(fname.c_str(), O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	uint64_t bytes = 0;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void* map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED)
+		{
+			size_t page = size_t(sysconf(_SC_PAGESIZE));
+			std::vector<unsigned char> resident((size_t(st.st_size) + page - 1) / page);
+			if (mincore(map, size_t(st.st_size), resident.data()) == 0)
+				for (unsigned char r : resident)
+					if (r & 1)
+						bytes += page;
+			munmap(map, size_t(st.st_size));
+		}
+	}
+	::close(fd);
+	return bytes;
+#else
+	(void)fname;
+	return 0;
+#endif
+}
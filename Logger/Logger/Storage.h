@@ -0,0 +1,40 @@
+#pragma once
+
+#include "gzstream.h"
+#include "configuration.hxx"
+
+#include <cstdint>
+#include <string>
+
+// How record files meet their medium, from <Storage>:
+//   BufferBytes  zlib's buffer; larger buffers mean fewer, bigger writes, which flash prefers
+//   Level        compression level, 1 fastest to 9 smallest
+//   Fsync        the periodic flush and every close reach the medium, so flushed
+//                records survive a power cut and not only a crash
+//   DropCache    closed files are written back and dropped from the page cache,
+//                as they are only read again for upload
+// The writer and Logger_StorageBench both go through here, so the bench
+// measures what the writer does.
+namespace Storage
+{
+	struct Policy
+	{
+		unsigned bufferBytes{0};  // 0 for zlib's default, 8KB
+		int level{-1};            // -1 for zlib's default, 6
+		bool fsync{false};
+		bool dropCache{false};
+
+		static Policy fromConfig(const loggercfg::Logger& cfg);
+	};
+
+	bool open(ogzstream& strm, const std::string& fname, const Policy& p);
+
+	// Everything written so far made decodable on disk, and durable under
+	// Fsync. Returns the compressed offset that covers, or -1
+	z_off_t flush(ogzstream& strm, const std::string& fname, const Policy& p);
+
+	void close(ogzstream& strm, const std::string& fname, const Policy& p);
+
+	// Bytes of the file held in the page cache. Linux only, 0 elsewhere
+	uint64_t cached(const std::string& fname);
+}
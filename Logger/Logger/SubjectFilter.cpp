@@ -0,0 +1,49 @@
+#include "SubjectFilter.h"
+
+void SubjectFilter::configure(const loggercfg::Logger& cfg)
+{
+	m_include.clear();
+	m_exclude.clear();
+
+	if (!cfg.Subscribe_present())
+		return;
+
+	for (const std::string& p : cfg.Subscribe().Include())
+		m_include.emplace_back(p);
+
+	for (const std::string& p : cfg.Subscribe().Exclude())
+		m_exclude.emplace_back(p);
+}
+
+std::vector<PubSub::Subject> SubjectFilter::subscriptions() const
+{
+	std::vector<PubSub::Subject> subs;
+	for (const Pattern& p : m_include)
+		subs.push_back(p.subject);
+
+	if (subs.empty())
+		subs.push_back({ "*" });
+
+	return subs;
+}
+
+bool SubjectFilter::pass(const PubSub::Subject& s)
+{
+	for (Pattern& p : m_exclude)
+		if (PubSub::match(p.subject, s))
+		{
+			p.dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+	return true;
+}
+
+uint64_t SubjectFilter::dropped() const
+{
+	uint64_t total = 0;
+	for (const Pattern& p : m_exclude)
+		total += p.dropped.load(std::memory_order_relaxed);
+
+	return total;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "HubApp/HubApp.h"
+#include "configuration.hxx"
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Include/exclude subject patterns from the <Subscribe> config element.
+// Include patterns become the hub subscriptions (falling back to "*"), exclude
+// patterns are checked on receipt so nothing is formatted for a dropped message.
+class SubjectFilter
+{
+public:
+	struct Pattern
+	{
+		explicit Pattern(const std::string& p) : text(p), subject(PubSub::parseSubject(p)) {}
+
+		std::string text;
+		PubSub::Subject subject;
+		std::atomic<uint64_t> dropped{0};
+	};
+
+	void configure(const loggercfg::Logger& cfg);
+
+	std::vector<PubSub::Subject> subscriptions() const;
+
+	// false if the subject matches an exclude pattern. The first matching pattern is charged with the drop
+	bool pass(const PubSub::Subject& s);
+
+	const std::deque<Pattern>& includes() const { return m_include; }
+	const std::deque<Pattern>& excludes() const { return m_exclude; }
+	uint64_t dropped() const;
+
+private:
+	std::deque<Pattern> m_include;
+	std::deque<Pattern> m_exclude;
+};
@@ -0,0 +1,160 @@
+#define fopen_s(FD, FPATH, FLAGS) *FD = fopen(FPATH, FLAGS);
+
+#include "TarStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const size_t TAR_BLOCK = 512;
+
+	void octal(char* field, size_t width, uint64_t v)
+	{
+		field[width - 1] = 0;
+		for (size_t i = width - 1; i-- > 0; v >>= 3)
+			field[i] = char('0' + (v & 7));
+	}
+
+	// Zeros taking size up to a whole block
+	std::string padding(uint64_t size)
+	{
+		return std::string(size % TAR_BLOCK ? TAR_BLOCK - size % TAR_BLOCK : 0, '\0');
+	}
+}
+
+TarStream::TarStream(const std::string& index, std::vector<Member> members)
+	: m_members(std::move(members))
+{
+	std::time_t newest = 0;
+	for (const Member& m : m_members)
+		newest = std::max(newest, m.mtime);
+
+	header("INDEX", index.size(), newest);
+	add(index + padding(index.size()));
+
+	for (size_t i = 0; i < m_members.size(); ++i)
+	{
+		const Member& m = m_members[i];
+		header(m.name, m.size, m.mtime);
+		m_segments.push_back(Segment{ m_size, m.size, std::string(), int(i) });
+		m_size += m.size;
+		add(padding(m.size));
+	}
+
+	// End of archive
+	add(std::string(TAR_BLOCK * 2, '\0'));
+}
+
+TarStream::~TarStream()
+{
+	if (m_file)
+		fclose(m_file);
+}
+
+void TarStream::add(std::string bytes)
+{
+	if (bytes.empty())
+		return;
+
+	uint64_t length = bytes.size();
+	m_segments.push_back(Segment{ m_size, length, std::move(bytes), -1 });
+	m_size += length;
+}
+
+void TarStream::header(const std::string& name, uint64_t size, std::time_t mtime)
+{
+	std::string h(TAR_BLOCK, '\0');
+	memcpy(&h[0], name.c_str(), std::min(name.size(), MAX_NAME));
+	octal(&h[100], 8, 0644);
+	octal(&h[108], 8, 0);
+	octal(&h[116], 8, 0);
+	octal(&h[124], 12, size);
+	octal(&h[136], 12, uint64_t(mtime));
+	h[156] = '0';
+	memcpy(&h[257], "ustar", 6);
+	memcpy(&h[263], "00", 2);
+
+	memset(&h[148], ' ', 8);
+	unsigned sum = 0;
+	for (char c : h)
+		sum += uint8_t(c);
+	octal(&h[148], 7, sum);
+
+	add(std::move(h));
+}
+
+bool TarStream::seek(uint64_t offset)
+{
+	if (offset > m_size)
+		return false;
+
+	m_pos = offset;
+	m_segment = 0;
+	while (m_segment + 1 < m_segments.size() && m_segments[m_segment + 1].start <= offset)
+		++m_segment;
+	return true;
+}
+
+bool TarStream::position(int member, uint64_t offset)
+{
+	if (m_open == member && m_filePos == offset)
+		return true;
+
+	if (m_open != member)
+	{
+		if (m_file)
+			fclose(m_file);
+		m_file = nullptr;
+		m_open = member;
+		fopen_s(&m_file, m_members[member].path.string().c_str(), "rb");
+		if (!m_file)
+			return false;
+	}
+
+#if defined(WIN32)
+	bool seeked = _fseeki64(m_file, int64_t(offset), SEEK_SET) == 0;
+#else
+	bool seeked = fseeko(m_file, off_t(offset), SEEK_SET) == 0;
+#endif
+	m_filePos = offset;
+	return seeked;
+}
+
+size_t TarStream::read(char* p, size_t n)
+{
+	size_t done = 0;
+	while (done < n && m_pos < m_size && !m_failed)
+	{
+		while (m_pos >= m_segments[m_segment].start + m_segments[m_segment].length)
+			++m_segment;
+
+		const Segment& s = m_segments[m_segment];
+		uint64_t in = m_pos - s.start;
+		size_t k = size_t(std::min<uint64_t>(n - done, s.length - in));
+
+		if (s.member < 0)
+			memcpy(p + done, s.bytes.data() + in, k);
+		else
+		{
+			if (!position(s.member, in))
+			{
+				m_failed = true;
+				break;
+			}
+
+			size_t r = fread(p + done, 1, k, m_file);
+			m_filePos += r;
+			if (r < k)
+			{
+				// The member is shorter than when the archive was laid out
+				m_failed = true;
+				k = r;
+			}
+		}
+
+		done += k;
+		m_pos += k;
+	}
+	return done;
+}
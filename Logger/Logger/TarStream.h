@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Logging/Log.h"
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+// A POSIX ustar archive of files on disk, produced as it is read rather than
+// written out first, so batching files costs no extra writes. The archive
+// starts with an INDEX member holding the caller's text. Its bytes depend
+// only on the index, member names, sizes and times, so a transfer of it can
+// resume at any offset.
+class TarStream
+{
+public:
+	struct Member
+	{
+		std::string name;
+		BF::path path;
+		uint64_t size{0};
+		std::time_t mtime{0};
+	};
+
+	// Longest member name. Longer ones would need the ustar prefix field,
+	// which only splits at a '/'
+	static constexpr size_t MAX_NAME = 100;
+
+	TarStream(const std::string& index, std::vector<Member> members);
+	~TarStream();
+
+	uint64_t size() const { return m_size; }
+
+	// Read from offset next. false if beyond the end
+	bool seek(uint64_t offset);
+
+	// Up to n bytes. Fewer only at the end or when a member cannot be read
+	size_t read(char* p, size_t n);
+	bool failed() const { return m_failed; }
+
+private:
+	struct Segment
+	{
+		uint64_t start;
+		uint64_t length;
+		std::string bytes;  // headers, the index and padding
+		int member;         // or the data of this member
+	};
+
+	void add(std::string bytes);
+	void header(const std::string& name, uint64_t size, std::time_t mtime);
+	bool position(int member, uint64_t offset);
+
+	std::vector<Member> m_members;
+	std::vector<Segment> m_segments;
+	uint64_t m_size{0};
+
+	uint64_t m_pos{0};
+	size_t m_segment{0};
+	bool m_failed{false};
+
+	FILE* m_file{nullptr};
+	int m_open{-1};
+	uint64_t m_filePos{0};
+};
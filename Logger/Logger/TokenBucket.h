@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+// Classic token bucket. A rate of zero means unlimited.
+class TokenBucket
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	TokenBucket() = default;
+	TokenBucket(double rate, double burst) { configure(rate, burst); }
+
+	void configure(double rate, double burst)
+	{
+		m_rate = rate;
+		m_burst = std::max(burst, 1.0);
+		m_tokens = m_burst;
+		m_last = clock::now();
+	}
+
+	double rate() const { return m_rate; }
+	bool unlimited() const { return m_rate <= 0.0; }
+
+	// Tokens available now
+	double available(clock::time_point now = clock::now())
+	{
+		if (unlimited())
+			return std::numeric_limits<double>::max();
+
+		refill(now);
+		return m_tokens;
+	}
+
+	// Change the rate without losing the tokens already accrued
+	void setRate(double rate, clock::time_point now = clock::now())
+	{
+		refill(now);
+		m_rate = rate;
+	}
+
+	// Consume n tokens if they are available
+	bool take(double n, clock::time_point now = clock::now())
+	{
+		if (unlimited())
+			return true;
+
+		refill(now);
+		if (m_tokens < n)
+			return false;
+
+		m_tokens -= n;
+		return true;
+	}
+
+	// Consume n tokens regardless, for use already made. The balance may go
+	// negative; wait() then includes paying it back
+	void debit(double n, clock::time_point now = clock::now())
+	{
+		if (unlimited())
+			return;
+
+		refill(now);
+		m_tokens -= n;
+	}
+
+	// Time until n tokens will be available
+	clock::duration wait(double n, clock::time_point now = clock::now())
+	{
+		if (unlimited())
+			return clock::duration::zero();
+
+		refill(now);
+		if (m_tokens >= n)
+			return clock::duration::zero();
+
+		return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((n - m_tokens) / m_rate));
+	}
+
+private:
+	void refill(clock::time_point now)
+	{
+		if (now > m_last)
+		{
+			m_tokens = std::min(m_burst, m_tokens + std::chrono::duration<double>(now - m_last).count() * m_rate);
+			m_last = now;
+		}
+	}
+
+	double m_rate{0.0};
+	double m_burst{1.0};
+	double m_tokens{1.0};
+	clock::time_point m_last{clock::now()};
+};
@@ -0,0 +1,111 @@
+#include "TopK.h"
+
+#include <algorithm>
+
+SpaceSaving::SpaceSaving(size_t capacity)
+	: m_capacity(std::max<size_t>(1, capacity))
+{
+	m_slots.reserve(m_capacity);
+	m_heap.reserve(m_capacity);
+	m_index.reserve(m_capacity);
+}
+
+void SpaceSaving::add(const std::string& key, uint64_t weight)
+{
+	m_total += weight;
+
+	auto i = m_index.find(key);
+	if (i != m_index.end())
+	{
+		Slot& s = m_slots[i->second];
+		s.e.count += weight;
+		siftDown(s.heapPos);
+		return;
+	}
+
+	if (m_slots.size() < m_capacity)
+	{
+		m_index.emplace(key, m_slots.size());
+		m_heap.push_back(m_slots.size());
+		m_slots.push_back(Slot{Entry{key, weight, 0}, m_heap.size() - 1});
+
+		// Restore the heap upwards; the new count may be the least
+		for (size_t pos = m_heap.size() - 1; pos && m_slots[m_heap[pos]].e.count < m_slots[m_heap[(pos - 1) / 2]].e.count; pos = (pos - 1) / 2)
+			swap(pos, (pos - 1) / 2);
+		return;
+	}
+
+	// Take over the least counted key
+	size_t idx = m_heap.front();
+	Slot& s = m_slots[idx];
+	m_index.erase(s.e.key);
+	s.e.key = key;
+	s.e.error = s.e.count;
+	s.e.count += weight;
+	m_index.emplace(key, idx);
+	siftDown(0);
+}
+
+std::vector<SpaceSaving::Entry> SpaceSaving::top(size_t k) const
+{
+	std::vector<Entry> r;
+	r.reserve(m_slots.size());
+	for (const Slot& s : m_slots)
+		r.push_back(s.e);
+
+	auto higher = [](const Entry& l, const Entry& rt) { return l.count > rt.count; };
+	if (r.size() > k)
+	{
+		std::partial_sort(r.begin(), r.begin() + k, r.end(), higher);
+		r.resize(k);
+	}
+	else
+		std::sort(r.begin(), r.end(), higher);
+	return r;
+}
+
+void SpaceSaving::clear()
+{
+	m_total = 0;
+	m_slots.clear();
+	m_heap.clear();
+	m_index.clear();
+}
+
+void SpaceSaving::siftDown(size_t pos)
+{
+	for (;;)
+	{
+		size_t least = pos;
+		for (size_t c = 2 * pos + 1; c <= 2 * pos + 2 && c < m_heap.size(); ++c)
+			if (m_slots[m_heap[c]].e.count < m_slots[m_heap[least]].e.count)
+				least = c;
+		if (least == pos)
+			return;
+		swap(pos, least);
+		pos = least;
+	}
+}
+
+void SpaceSaving::swap(size_t a, size_t b)
+{
+	std::swap(m_heap[a], m_heap[b]);
+	m_slots[m_heap[a]].heapPos = a;
+	m_slots[m_heap[b]].heapPos = b;
+}
+
+SubjectTop::Table SubjectTop::table(size_t k) const
+{
+	Table t;
+	t.msgs = m_msgs.total();
+	t.bytes = m_bytes.total();
+	t.byMsgs = m_msgs.top(k);
+	t.byBytes = m_bytes.top(k);
+	return t;
+}
+
+void SubjectTop::clear()
+{
+	m_msgs.clear();
+	m_bytes.clear();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Heavy hitters in bounded memory, by the Space-Saving algorithm. At most
+// capacity keys are tracked; a new key takes over the least counted one and
+// inherits its count as its error, so a reported count is never below the
+// truth and at most error above it. Any key with more than total / capacity
+// of the weight is certain to be tracked. Not thread safe.
+class SpaceSaving
+{
+public:
+	struct Entry
+	{
+		std::string key;
+		uint64_t count{0};
+		uint64_t error{0};
+	};
+
+	explicit SpaceSaving(size_t capacity);
+
+	void add(const std::string& key, uint64_t weight);
+
+	// The k highest counts, highest first
+	std::vector<Entry> top(size_t k) const;
+
+	uint64_t total() const { return m_total; }
+	void clear();
+
+private:
+	struct Slot
+	{
+		Entry e;
+		size_t heapPos;
+	};
+
+	void siftDown(size_t pos);
+	void swap(size_t a, size_t b);
+
+	size_t m_capacity;
+	uint64_t m_total{0};
+	std::vector<Slot> m_slots;
+	std::vector<size_t> m_heap;  // slot indexes, least count first
+	std::unordered_map<std::string, size_t> m_index;
+};
+
+// The subjects carrying the most messages and the most payload bytes
+class SubjectTop
+{
+public:
+	struct Table
+	{
+		uint64_t msgs{0};
+		uint64_t bytes{0};
+		std::vector<SpaceSaving::Entry> byMsgs;
+		std::vector<SpaceSaving::Entry> byBytes;
+	};
+
+	explicit SubjectTop(size_t capacity) : m_msgs(capacity), m_bytes(capacity) {}
+
+	void add(const std::string& subject, size_t bytes)
+	{
+		m_msgs.add(subject, 1);
+		m_bytes.add(subject, bytes);
+	}
+
+	Table table(size_t k) const;
+	void clear();
+
+private:
+	SpaceSaving m_msgs;
+	SpaceSaving m_bytes;
+};
@@ -0,0 +1,271 @@
+#include "TraceRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <vector>
+#if defined(WIN32)
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+Trace::detail::Slot Trace::detail::g_ring[Trace::CAPACITY];
+std::atomic<uint64_t> Trace::detail::g_head{0};
+
+namespace
+{
+	const char MAGIC[8] = { 'L', 'G', 'T', 'R', 'A', 'C', 'E', '1' };
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t capacity;
+		uint32_t slotSize;
+		uint64_t head;
+		uint64_t steadyNs;  // both clocks, read as the dump was taken
+		uint64_t wallNs;
+	};
+
+	// A slot as it is laid out in a dump
+	struct RawSlot
+	{
+		uint64_t seq;
+		uint64_t ns;
+		uint64_t a;
+		uint64_t info;
+	};
+
+	const char* const EVENT_NAMES[Trace::EVENTS] = { "Receive", "Dequeue", "Write", "Rotate", "Flush", "Trigger", "Upload", "Dump" };
+	const char* const STEP_NAMES[Trace::UPLOAD_STEPS] = { "started", "file", "sent", "progress", "complete", "incomplete", "failed" };
+
+	std::atomic<uint16_t> g_nextThread{0};
+	std::atomic<int> g_dumps{0};
+
+	// dir/trace.<pid>. built ahead so a dump only has to append its number
+	char g_prefix[1024] = "trace.";
+
+	// Async-signal-safe string building; the string functions are not guaranteed to be
+	char* append(char* p, const char* end, const char* s)
+	{
+		while (*s && p < end)
+			*p++ = *s++;
+		return p;
+	}
+
+	char* append(char* p, const char* end, uint64_t n)
+	{
+		char digits[20];
+		int len = 0;
+		do
+		{
+			digits[len++] = char('0' + n % 10);
+			n /= 10;
+		} while (n);
+
+		while (len && p < end)
+			*p++ = digits[--len];
+		return p;
+	}
+
+	void clocks(uint64_t& steadyNs, uint64_t& wallNs)
+	{
+#if defined(WIN32)
+		steadyNs = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		wallNs = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+#else
+		// steady_clock is CLOCK_MONOTONIC; clock_gettime is safe in a signal handler
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		steadyNs = uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		wallNs = uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+#endif
+	}
+
+#if !defined(WIN32)
+	bool writeAll(int fd, const void* data, size_t size)
+	{
+		const char* p = static_cast<const char*>(data);
+		while (size)
+		{
+			ssize_t w = ::write(fd, p, size);
+			if (w < 0 && errno == EINTR)
+				continue;
+			if (w <= 0)
+				return false;
+			p += w;
+			size -= size_t(w);
+		}
+		return true;
+	}
+
+	void onSignal(int)
+	{
+		int saved = errno;
+		Trace::dump();
+		errno = saved;
+	}
+#endif
+}
+
+uint16_t Trace::detail::thread()
+{
+	thread_local uint16_t id = uint16_t(g_nextThread.fetch_add(1, std::memory_order_relaxed) + 1);
+	return id;
+}
+
+void Trace::setDumpDir(const std::string& dir)
+{
+	std::string prefix = dir.empty() ? std::string() : dir + "/";
+#if defined(WIN32)
+	prefix += "trace." + std::to_string(_getpid()) + ".";
+#else
+	prefix += "trace." + std::to_string(getpid()) + ".";
+#endif
+	if (prefix.size() < sizeof(g_prefix))
+		memcpy(g_prefix, prefix.c_str(), prefix.size() + 1);
+}
+
+std::string Trace::dumpPath(int n)
+{
+	return g_prefix + std::to_string(n) + ".bin";
+}
+
+int Trace::dump()
+{
+	int n = g_dumps.fetch_add(1, std::memory_order_relaxed);
+	record(Dump, uint64_t(n));
+
+	char path[sizeof(g_prefix) + 32];
+	const char* end = path + sizeof(path) - 1;
+	char* p = append(path, end, g_prefix);
+	p = append(p, end, uint64_t(n));
+	p = append(p, end, ".bin");
+	*p = 0;
+
+	Header h;
+	memcpy(h.magic, MAGIC, sizeof(h.magic));
+	h.capacity = uint32_t(CAPACITY);
+	h.slotSize = uint32_t(sizeof(detail::Slot));
+	h.head = detail::g_head.load(std::memory_order_acquire);
+	clocks(h.steadyNs, h.wallNs);
+
+#if defined(WIN32)
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return -1;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(detail::g_ring, sizeof(detail::g_ring), 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+#else
+	int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	bool ok = writeAll(fd, &h, sizeof(h)) && writeAll(fd, detail::g_ring, sizeof(detail::g_ring));
+	ok = ::close(fd) == 0 && ok;
+#endif
+	return ok ? n : -1;
+}
+
+void Trace::dumpOnSignal(int sig)
+{
+#if defined(WIN32)
+	(void)sig;
+#else
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onSignal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(sig, &sa, nullptr);
+
+	// Threads started from here on inherit the mask, so no thread blocks it
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+	pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+#endif
+}
+
+bool Trace::decode(std::istream& in, std::ostream& out)
+{
+	Header h;
+	if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0 || h.slotSize != sizeof(RawSlot))
+		return false;
+
+	std::vector<RawSlot> slots(h.capacity);
+	in.read(reinterpret_cast<char*>(slots.data()), std::streamsize(slots.size() * sizeof(RawSlot)));
+	slots.resize(size_t(in.gcount()) / sizeof(RawSlot));
+
+	// Unused slots and any overwritten while the dump was written are left out
+	uint64_t oldest = h.head > h.capacity ? h.head - h.capacity : 0;
+	slots.erase(std::remove_if(slots.begin(), slots.end(),
+		[&](const RawSlot& s) { return s.seq <= oldest || s.seq > h.head || (s.info & 0xFFFF) >= EVENTS; }), slots.end());
+	std::sort(slots.begin(), slots.end(), [](const RawSlot& l, const RawSlot& r) { return l.seq < r.seq; });
+
+	out << "# " << slots.size() << " events, " << h.head << " recorded since start. Times UTC, +ms since the previous event" << std::endl;
+
+	uint64_t prevNs = slots.empty() ? 0 : slots.front().ns;
+	for (const RawSlot& s : slots)
+	{
+		uint64_t wallNs = h.wallNs - std::min(h.wallNs, h.steadyNs - std::min(h.steadyNs, s.ns));
+		std::time_t tt = std::time_t(wallNs / 1000000000);
+#if defined(WIN32)
+		tm t;
+		gmtime_s(&t, &tt);
+#else
+		tm t;
+		gmtime_r(&tt, &t);
+#endif
+		Event e = Event(s.info & 0xFFFF);
+		uint32_t thread = uint32_t(s.info >> 16) & 0xFFFF;
+		uint32_t b = uint32_t(s.info >> 32);
+
+		out << std::put_time(&t, "%Y-%m-%d %H:%M:%S") << "." << std::setw(6) << std::setfill('0') << wallNs / 1000 % 1000000
+			<< std::setfill(' ') << " +" << std::fixed << std::setprecision(3) << std::setw(9) << (s.ns - std::min(s.ns, prevNs)) / 1e6
+			<< " T" << std::left << std::setw(3) << thread << std::right << " " << std::left << std::setw(8) << EVENT_NAMES[e] << std::right;
+		prevNs = s.ns;
+
+		switch (e)
+		{
+		case Receive:
+			out << " bytes=" << s.a << " depth=" << b;
+			break;
+		case Dequeue:
+			out << " queued=" << s.a << "us depth=" << b;
+			break;
+		case Write:
+			out << " bytes=" << s.a << " took=" << b << "us";
+			break;
+		case Rotate:
+			out << " took=" << s.a << "us";
+			break;
+		case Flush:
+			out << " records=" << s.a << " took=" << b << "us";
+			break;
+		case Trigger:
+			out << " bytes=" << s.a << " took=" << b << "us";
+			break;
+		case Upload:
+			out << " " << (b < UPLOAD_STEPS ? STEP_NAMES[b] : "?") << " bytes=" << s.a;
+			break;
+		case Dump:
+			out << " n=" << s.a;
+			break;
+		default:
+			break;
+		}
+		out << std::endl;
+	}
+
+	return true;
+}
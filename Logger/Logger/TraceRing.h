@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Flight recorder of pipeline events. A fixed ring holds the last CAPACITY
+// events, each with a timestamp, the recording thread and two event specific
+// values. It is always on, so a stall in the field can be examined after the
+// fact: recording is a clock read and a few relaxed stores, with nothing
+// formatted or locked. dump() writes the ring out as it stands and is
+// async-signal-safe, for SIGUSR1; decode() turns a dump back into text.
+namespace Trace
+{
+	enum Event : uint16_t
+	{
+		Receive,   // a = payload bytes, b = queue depth after
+		Dequeue,   // a = us queued, b = queue depth after
+		Write,     // a = line bytes, b = us to encode, format and compress
+		Rotate,    // a = us taken
+		Flush,     // a = records made durable, b = us taken
+		Trigger,   // an event matched. a = payload bytes, b = us to evaluate it
+		Upload,    // a = bytes so far, b = UploadStep
+		Dump,      // a = dump number
+		EVENTS
+	};
+
+	enum UploadStep : uint32_t
+	{
+		UploadStarted,
+		UploadFile,
+		UploadSent,
+		UploadProgress,
+		UploadComplete,
+		UploadIncomplete,
+		UploadFailed,
+		UPLOAD_STEPS
+	};
+
+	const size_t CAPACITY = 32768;
+
+	namespace detail
+	{
+		// info holds b << 32 | thread << 16 | event. seq is the event's position
+		// plus one, written last, so a decoder can tell old and unused slots
+		struct Slot
+		{
+			std::atomic<uint64_t> seq;
+			std::atomic<uint64_t> ns;
+			std::atomic<uint64_t> a;
+			std::atomic<uint64_t> info;
+		};
+
+		extern Slot g_ring[CAPACITY];
+		extern std::atomic<uint64_t> g_head;
+
+		uint16_t thread();
+	}
+
+	inline void record(Event e, uint64_t a = 0, uint32_t b = 0)
+	{
+		uint64_t seq = detail::g_head.fetch_add(1, std::memory_order_relaxed);
+		detail::Slot& s = detail::g_ring[seq % CAPACITY];
+		s.ns.store(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()), std::memory_order_relaxed);
+		s.a.store(a, std::memory_order_relaxed);
+		s.info.store(uint64_t(b) << 32 | uint64_t(detail::thread()) << 16 | e, std::memory_order_relaxed);
+		s.seq.store(seq + 1, std::memory_order_release);
+	}
+
+	// Microseconds since start, clamped at zero and to 32 bits
+	inline uint32_t usSince(std::chrono::steady_clock::time_point start)
+	{
+		int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		return us < 0 ? 0 : us > int64_t(UINT32_MAX) ? UINT32_MAX : uint32_t(us);
+	}
+
+	// Dumps go to dir/trace.<pid>.<n>.bin. Call at start up and configuration,
+	// not from a signal handler
+	void setDumpDir(const std::string& dir);
+	std::string dumpPath(int n);
+
+	// Writes the ring to the next dump file and returns its number, or -1.
+	// Async-signal-safe. An event being recorded as the dump is taken may be garbled
+	int dump();
+
+	// dump() whenever sig arrives, unblocking it in the calling thread. Call
+	// before starting threads. Not available on Windows
+	void dumpOnSignal(int sig);
+
+	// Prints a dump oldest event first. false if in is not a trace dump
+	bool decode(std::istream& in, std::ostream& out);
+}
@@ -0,0 +1,307 @@
+#include "Uploader.h"
+#include "XmlEscape.h"
+#include "SftpTransfer.h"
+#include "Metrics.h"
+#include "TraceRing.h"
+#include "Profiler.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <string>
+#include <sstream>
+#include <thread>
+
+namespace Logging
+{
+	template <> const char* getLCStr<LC_Upload   >() { return "Upload  "; }
+}
+
+using namespace Logging;
+
+namespace
+{
+	// In the order of Trace::UploadStep
+	const char* const UPLOAD_STEPS[] = { "started", "file", "sent", "progress", "complete", "incomplete", "failed" };
+}
+
+Uploader::Uploader(Logging::LogFile& log, const loggercfg::Logger& cfg, const Destination& dest, Outbox& outbox, Shaper& shaper,
+	std::function<bool(std::string&, uint64_t&)> live, std::function<void(const std::string&)> status)
+	: Task::TActiveTask<Uploader>(1)
+	, Logging::LogClient(log)
+	, m_dest(dest)
+	, m_outbox(outbox)
+	, m_live(live)
+	, m_status(status)
+	, m_shaper(shaper)
+{
+	cfg._copy(m_cfg);
+	m_session.reset(new SftpSession(log, m_dest, m_cfg.FtpUpload()));
+
+	getMsgDispatcher().start();
+
+	if (m_cfg.FtpUpload().KeepaliveS())
+		m_keepaliveMsg = enqueueWithDelay<evKeepalive>(std::chrono::seconds(m_cfg.FtpUpload().KeepaliveS()), true);
+	if (m_cfg.FtpUpload().StreamS())
+		m_streamMsg = enqueueWithDelay<evStream>(std::chrono::seconds(m_cfg.FtpUpload().StreamS()), true);
+}
+
+Uploader::~Uploader()
+{
+	m_stopping = true;
+	m_keepaliveMsg.reset();
+	m_streamMsg.reset();
+	m_retryMsg.reset();
+	getMsgDispatcher().stop();
+}
+
+void Uploader::request()
+{
+	if (!m_pending.exchange(true))
+		enqueue<evUpload>();
+	else
+		LOG(LL_Debug, LC_Upload, "Upload already queued");
+}
+
+void Uploader::setPrefix(const std::string& prefix)
+{
+	std::unique_lock<std::mutex> s(m_prefixLock);
+	m_prefix = prefix;
+}
+
+template <> void Uploader::processEvent<Uploader::evUpload>()
+{
+	// Clear before starting so a trigger arriving mid upload queues one more run
+	m_pending = false;
+
+	if (!m_stopping)
+		upload();
+}
+
+template <> void Uploader::processEvent<Uploader::evRetry>()
+{
+	m_retryMsg.reset();
+	if (!m_stopping)
+		request();
+}
+
+template <> void Uploader::processEvent<Uploader::evStream>()
+{
+	if (!m_stopping)
+		request();
+}
+
+template <> void Uploader::processEvent<Uploader::evKeepalive>()
+{
+	if (!m_stopping)
+		m_session->keepalive();
+}
+
+void Uploader::retry()
+{
+	if (m_stopping || m_retryMsg)
+		return;
+
+	auto delay = std::max<std::chrono::steady_clock::duration>(m_session->retryIn(), std::chrono::seconds(1));
+	LOG(LL_Info, LC_Upload, "Retrying upload to " << m_dest.name << " in " << std::chrono::duration_cast<std::chrono::seconds>(delay).count() << "s");
+	m_retryMsg = enqueueWithDelay<evRetry>(delay);
+}
+
+void Uploader::report(const char* state, const Progress& p, const std::string& file, const std::string& error)
+{
+	std::stringstream strm;
+	strm << "<Upload Destination=\"" << xmlEscape(m_dest.name) << "\" State=\"" << state << "\" Files=\"" << p.files << "\" Done=\"" << p.done << "\" Bytes=\"" << p.bytes << "\"";
+	if (!file.empty())
+		strm << " File=\"" << xmlEscape(file) << "\"";
+	if (!error.empty())
+		strm << " Error=\"" << xmlEscape(error) << "\"";
+	strm << "/>";
+
+	m_status(strm.str());
+
+	size_t step = 0;
+	while (step < Trace::UPLOAD_STEPS && strcmp(UPLOAD_STEPS[step], state) != 0)
+		++step;
+	if (step < Trace::UPLOAD_STEPS)
+		Trace::record(Trace::Upload, p.bytes, uint32_t(step));
+}
+
+void Uploader::upload()
+{
+	Profiler::tag(Profiler::RoleUploader);
+
+	Progress prog;
+	auto started = std::chrono::steady_clock::now();
+	bool streaming = m_cfg.FtpUpload().StreamS() > 0;
+
+	// Oldest first, each resuming from the offset this destination has confirmed
+	Outbox& outbox = m_outbox;
+	for (const std::string& name : outbox.unverified())
+		if (!m_stopping)
+			outbox.verify(name);
+
+	// After verify(), as archives list their members' CRCs
+	if (m_cfg.FtpUpload().BatchFiles() > 1)
+		outbox.batch(m_cfg.FtpUpload().BatchFiles());
+	std::vector<Outbox::Entry> pending = outbox.pending(m_dest.name);
+	std::deque<Outbox::Entry> queue(pending.begin(), pending.end());
+
+	// Claimed by pending() until this run ends, however it ends
+	struct Release
+	{
+		Outbox& outbox;
+		const std::string& dest;
+		~Release() { outbox.release(dest); }
+	} release{ outbox, m_dest.name };
+	prog.files = queue.size();
+
+	// The live file up to its last sync flush, appended to what the server already has
+	BF::path live;
+	uint64_t liveFrom = 0, liveTo = 0;
+	if (streaming)
+	{
+		std::string fname;
+		if (m_live && m_live(fname, liveTo))
+		{
+			live = fname;
+			liveFrom = outbox.liveOffset(live.filename().string(), m_dest.name);
+			if (liveTo <= liveFrom)
+				live.clear();
+		}
+
+		// Routine streaming ticks only report when closed files are shipped
+		if (queue.empty() && live.empty())
+			return;
+	}
+	bool quiet = streaming && queue.empty();
+
+	if (!quiet)
+		report("started", prog);
+
+	bool reused = m_session->connected();
+	if (!m_session->sftp())
+	{
+		report("failed", prog, std::string(), m_session->lastError());
+		retry();
+		return;
+	}
+
+	std::string prefix;
+	{
+		std::unique_lock<std::mutex> s(m_prefixLock);
+		prefix = m_prefix;
+	}
+	std::string destpath = m_dest.path + '/' + prefix;
+
+	// Keep up to Concurrency files moving over the one session
+	size_t concurrency = std::max(1u, m_cfg.FtpUpload().Concurrency());
+	std::list<std::unique_ptr<SftpTransfer>> active;
+	bool lost = false;
+
+	if (!live.empty())
+	{
+		LOG(LL_Debug, LC_Upload, "Streaming " << live.filename() << " to " << m_dest.name << " " << liveFrom << "-" << liveTo);
+		active.emplace_back(new SftpTransfer(*m_session, m_shaper, live, destpath + live.filename().string(), liveFrom, liveTo));
+	}
+
+	libssh2_session_set_blocking(m_session->session(), 0);
+	while ((!queue.empty() || !active.empty()) && !m_stopping && !lost)
+	{
+		while (active.size() < concurrency && !queue.empty())
+		{
+			Outbox::Entry e = queue.front();
+			queue.pop_front();
+			LOG(LL_Info, LC_Upload, "Uploading " << e.name << " to " << m_dest.name << (e.offset ? " from " + std::to_string(e.offset) : std::string()));
+			report("file", prog, e.name);
+			active.emplace_back(new SftpTransfer(*m_session, m_shaper, outbox.path(e.name), destpath + e.name, e.offset, UINT64_MAX, outbox.archive(e)));
+		}
+
+		bool progressed = false;
+		for (auto it = active.begin(); it != active.end() && !lost;)
+		{
+			SftpTransfer& t = **it;
+			uint64_t before = t.sent();
+			SftpTransfer::Status s = t.step();
+			prog.bytes += t.sent() - before;
+			Metrics::add(Metrics::UploadBytes, t.sent() - before);
+			progressed |= t.sent() != before || s != SftpTransfer::Status::Blocked;
+
+			switch (s)
+			{
+			case SftpTransfer::Status::Blocked:
+				++it;
+				continue;
+			case SftpTransfer::Status::Done:
+				if (t.local() == live)
+				{
+					outbox.confirm(live.filename().string(), m_dest.name, t.offset());
+					break;
+				}
+				LOG(LL_Info, LC_Upload, "Uploaded " << t.local().filename() << " to " << m_dest.name);
+				outbox.sent(t.local().filename().string(), m_dest.name);
+				Metrics::add(Metrics::UploadFiles);
+				report("sent", prog, t.local().filename().string());
+				++prog.done;
+				break;
+			case SftpTransfer::Status::Failed:
+				LOG(LL_Warning, LC_Upload, t.error());
+				Metrics::add(Metrics::UploadFailures);
+				outbox.confirm(t.local().filename().string(), m_dest.name, t.offset());
+				break;
+			case SftpTransfer::Status::SessionLost:
+				lost = true;
+				Metrics::add(Metrics::UploadFailures);
+				outbox.confirm(t.local().filename().string(), m_dest.name, t.offset());
+				m_session->drop(t.error());
+				break;
+			}
+			it = active.erase(it);
+		}
+
+		if (std::chrono::steady_clock::now() - prog.reported > std::chrono::seconds(1))
+		{
+			prog.reported = std::chrono::steady_clock::now();
+			if (!quiet)
+				report("progress", prog);
+
+			for (const auto& t : active)
+				outbox.confirm(t->local().filename().string(), m_dest.name, t->offset());
+		}
+
+		m_shaper.sample(m_dest.name, m_session->socket());
+
+		// Capped so stop requests and progress reports stay responsive
+		if (!progressed && !lost)
+		{
+			auto throttled = m_shaper.wait();
+			if (throttled > std::chrono::steady_clock::duration::zero())
+				std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(throttled, std::chrono::seconds(1)));
+			else
+				m_session->waitSocket(std::chrono::milliseconds(1000));
+		}
+	}
+	for (const auto& t : active)
+		outbox.confirm(t->local().filename().string(), m_dest.name, t->offset());
+	active.clear();
+	if (m_session->connected())
+		libssh2_session_set_blocking(m_session->session(), 1);
+
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+	if (!quiet)
+		LOG(LL_Info, LC_Upload, "Uploaded " << prog.done << "/" << prog.files << " files to " << m_dest.name << ", " << prog.bytes << " bytes in " << ms.count() << "ms"
+			<< (reused ? " on a reused session" : " including a ") << (reused ? "" : std::to_string(m_session->connectTime().count()) + "ms connect"));
+
+	if (!m_session->connected())
+	{
+		report("failed", prog, std::string(), m_session->lastError());
+		retry();
+		return;
+	}
+
+	m_session->succeeded();
+	if (!quiet)
+		report(prog.done == prog.files ? "complete" : "incomplete", prog);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Logging/Log.h"
+#include "Task/TTask.h"
+#include "configuration.hxx"
+#include "Destination.h"
+#include "Outbox.h"
+#include "SftpSession.h"
+#include "Shaper.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Ships the outbox to one destination on its own thread, so the dispatcher
+// never blocks on the network and a slow destination never holds back the
+// others. Triggers only post a job; triggers arriving while a job is queued
+// are coalesced into it, and one arriving mid upload queues a single rerun.
+// The dispatcher rotates the current file before requesting a job.
+// Progress is reported through the status callback as an <Upload/> element.
+// The shaper is shared with the other destinations' uploaders, so the rate
+// limit applies to their total. The SFTP session is kept open between uploads; a job that cannot connect
+// or loses the session is retried once the session's backoff has elapsed.
+// In streaming mode (FtpUpload/@StreamS) a job runs every StreamS seconds
+// without rotating, appending the live file up to its last sync flush.
+class Uploader : public Task::TActiveTask<Uploader>, public Logging::LogClient
+{
+	loggercfg::Logger m_cfg;
+	Destination m_dest;
+	Outbox& m_outbox;
+	std::function<bool(std::string&, uint64_t&)> m_live;
+	std::function<void(const std::string&)> m_status;
+
+	std::mutex m_prefixLock;
+	std::string m_prefix;
+
+	std::atomic<bool> m_pending{false};
+	std::atomic<bool> m_stopping{false};
+
+	std::unique_ptr<SftpSession> m_session;
+	Shaper& m_shaper;
+	Task::MsgDelayMsgPtr m_keepaliveMsg;
+	Task::MsgDelayMsgPtr m_retryMsg;
+	Task::MsgDelayMsgPtr m_streamMsg;
+
+	struct Progress
+	{
+		uint32_t files{0};
+		uint32_t done{0};
+		uint64_t bytes{0};
+		std::chrono::steady_clock::time_point reported;
+	};
+
+	void upload();
+	void retry();
+	void report(const char* state, const Progress& p, const std::string& file = std::string(), const std::string& error = std::string());
+
+public:
+	// live reports the current file and how far it is decodable, as
+	// PSubLocal::liveBoundary does; only called in streaming mode
+	Uploader(Logging::LogFile& log, const loggercfg::Logger& cfg, const Destination& dest, Outbox& outbox, Shaper& shaper,
+		std::function<bool(std::string&, uint64_t&)> live, std::function<void(const std::string&)> status);
+	~Uploader();
+
+	// Queue an upload unless one is already waiting to start
+	void request();
+
+	// Remote file name prefix identifying this terminal
+	void setPrefix(const std::string& prefix);
+
+	struct evUpload;
+	struct evRetry;
+	struct evKeepalive;
+	struct evStream;
+	template <typename M> void processEvent();
+};
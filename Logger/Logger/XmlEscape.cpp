@@ -0,0 +1,16 @@
+#include "XmlEscape.h"
+
+std::string xmlEscape(const std::string& s)
+{
+	std::string r;
+	for (char c : s)
+		switch (c)
+		{
+		case '&': r += "&amp;"; break;
+		case '<': r += "&lt;"; break;
+		case '>': r += "&gt;"; break;
+		case '"': r += "&quot;"; break;
+		default: r += c; break;
+		}
+	return r;
+}
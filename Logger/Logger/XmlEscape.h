@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// s made safe inside an XML attribute or element, for the status messages
+// built by hand
+std::string xmlEscape(const std::string& s);
@@ -58,10 +58,14 @@ gzstreambuf* gzstreambuf::open( const char* name, int open_mode) {
     else if ( mode & std::ios::out)
         *fmodeptr++ = 'w';
     *fmodeptr++ = 'b';
+    if ( (mode & std::ios::out) && level >= 0 && level <= 9)
+        *fmodeptr++ = char('0' + level);
     *fmodeptr = '\0';
     file = gzopen( name, fmode);
     if (file == 0)
         return (gzstreambuf*)0;
+    if ( bufBytes)
+        gzbuffer( file, bufBytes);
     opened = 1;
     return this;
 }
@@ -134,8 +138,10 @@ int gzstreambuf::sync() {
     return 0;
 }
 
-int gzstreambuf::syncflush() {
-    return gzflush( file, Z_SYNC_FLUSH );
+z_off_t gzstreambuf::syncflush() {
+    if ( sync() == -1 || gzflush( file, Z_SYNC_FLUSH ) != Z_OK)
+        return -1;
+    return gzoffset( file);
 }
 
 // --------------------------------------
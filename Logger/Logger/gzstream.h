@@ -52,10 +52,12 @@ private:
     char             buffer[bufferSize]; // data buffer
     char             opened;             // open/close state of stream
     int              mode;               // I/O mode
+    int              level;              // compression level, -1 for zlib's default
+    unsigned         bufBytes;           // zlib buffer size, 0 for zlib's default
 
     int flush_buffer();
 public:
-    gzstreambuf() : opened(0) {
+    gzstreambuf() : opened(0), level(-1), bufBytes(0) {
         setp( buffer, buffer + (bufferSize-1));
         setg( buffer + 4,     // beginning of putback area
               buffer + 4,     // read position
@@ -63,10 +65,17 @@ public:
         // ASSERT: both input & output capabilities will not be used together
     }
     int is_open() { return opened; }
+    // Compression level 0..9 and zlib buffer size for the next open; -1 and 0 for zlib's defaults
+    void setparams( int lvl, unsigned bytes) { level = lvl; bufBytes = bytes; }
     gzstreambuf* open( const char* name, int open_mode);
     gzstreambuf* close();
     ~gzstreambuf() { close(); }
-	int syncflush();
+    // Compress everything written so far up to a byte boundary a reader can
+    // decode to, and return the compressed file offset of that boundary
+    z_off_t syncflush();
+    // Uncompressed bytes written so far, and compressed bytes handed to the file
+    z_off_t written() { return opened ? gztell( file) + ( pptr() - pbase()) : 0; }
+    z_off_t compressed() { return opened ? gzoffset( file) : 0; }
 
     virtual int     overflow( int c = EOF);
     virtual int     underflow();
@@ -0,0 +1,464 @@
+#include "Logging/Log.h"
+#include "Logger/configuration-pimpl.hxx"
+#include "Logger/EventMatch.h"
+#include "Logger/Outbox.h"
+#include "Logger/RecFormat.h"
+#include "Logger/Rotation.h"
+#include "Logger/Storage.h"
+#include "Logger/gzstream.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cctype>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the record path and trigger matching. Inputs are either
+// synthetic, generated from a fixed seed so every run sees the same bytes, or
+// the records of a captured file given with --trace=<file.rec.gz>.
+//
+//   bench [--trace=<file.rec.gz>] [--work=<dir>] [benchmark options]
+//
+// Files are written under <dir>/loggerbench, /tmp by default, which is
+// removed on exit. --benchmark_filter=<regex> selects benchmarks; see --help
+// for the rest.
+
+std::string g_work("/tmp");
+std::string g_trace;
+
+Logging::LogFile logfile;
+
+// The required elements; each benchmark adds those it exercises
+const char* CONFIG_PREFIX = "<Logger><LogPath>";
+const char* CONFIG_SUFFIX = "</LogPath><FileNameRoot>bench</FileNameRoot><MaxFileCount>";
+
+const size_t PAYLOAD_SIZES[] = { 64, 256, 1024, 4096, 16384 };
+
+// Delta against plain: payload sizes, and KeyframeN values with 0 for plain
+const size_t DELTA_SIZES[] = { 256, 4096 };
+const uint32_t DELTA_KEYFRAMES[] = { 0, 10, 100 };
+
+// Enough for several keyframe intervals on each of the 32 subjects
+const size_t DELTA_MESSAGES = 8192;
+
+// Trigger subjects taken from a trace
+const size_t MAX_TRACE_TRIGGERS = 64;
+
+// Raw record bytes written to one file before the gzip benchmarks start another
+const uint64_t MAX_FILE_BYTES = 256 * 1024 * 1024;
+
+loggercfg::Logger parseConfig(const std::string& xml)
+{
+	loggercfg::Logger cfg;
+	loggercfg::Logger_paggr s;
+	xml_schema::document_pimpl d(s.root_parser(), s.root_name());
+	std::istringstream strm(xml);
+	s.pre();
+	d.parse(strm);
+	std::unique_ptr<loggercfg::Logger>{s.post()}->_copy(cfg);
+	return cfg;
+}
+
+std::string scratch(const std::string& name = std::string())
+{
+	return (BF::path(g_work) / "loggerbench" / name).string();
+}
+
+std::string config(uint32_t maxFiles, const std::string& body = std::string())
+{
+	return CONFIG_PREFIX + scratch("rotation") + CONFIG_SUFFIX + std::to_string(maxFiles) + "</MaxFileCount>" + body + "</Logger>";
+}
+
+// An XML status message of about size bytes, as most bus traffic is. The
+// values vary but repeat, so it compresses roughly as real traffic does
+std::string payload(std::mt19937& rng, size_t size)
+{
+	static const char* STATES[] = { "idle", "running", "stopped", "fault" };
+
+	std::stringstream strm;
+	strm << "<Status Seq=\"" << rng() % 100000 << "\" State=\"" << STATES[rng() % 4] << "\">";
+	while (strm.tellp() < std::streamoff(size) - 9)
+		strm << "<V" << rng() % 16 << ">" << rng() % 1000 << "</V>";
+	strm << "</Status>";
+	return strm.str();
+}
+
+std::vector<PubSub::Message> synthetic(size_t size, size_t count)
+{
+	std::mt19937 rng(1);
+	std::vector<PubSub::Message> msgs;
+	for (size_t i = 0; i < count; ++i)
+	{
+		PubSub::Message m(PubSub::parseSubject("Bench.Unit" + std::to_string(i % 32) + ".Status"), payload(rng, size), std::chrono::minutes(1));
+		m.postmarks = { uint32_t(rng()), uint32_t(rng()) };
+		msgs.push_back(std::move(m));
+	}
+	return msgs;
+}
+
+// Like synthetic, but each subject's payload differs from its previous one
+// in only a few values, as periodic status does, for the Delta variants
+std::vector<PubSub::Message> evolving(size_t size, size_t count)
+{
+	std::mt19937 rng(1);
+	std::vector<std::string> last(32);
+	std::vector<PubSub::Message> msgs;
+	for (size_t i = 0; i < count; ++i)
+	{
+		std::string& p = last[i % last.size()];
+		if (p.empty())
+			p = payload(rng, size);
+		else
+			for (int k = 0; k < 4; ++k)
+			{
+				// Only digits of a value or attribute, never of an element name
+				size_t at = rng() % p.size(), from = at;
+				while (from > 0 && isdigit((unsigned char)p[from - 1]))
+					--from;
+				if (isdigit((unsigned char)p[at]) && from > 0 && (p[from - 1] == '>' || p[from - 1] == '"'))
+					p[at] = char('0' + rng() % 10);
+			}
+
+		PubSub::Message m(PubSub::parseSubject("Bench.Unit" + std::to_string(i % last.size()) + ".Status"), p, std::chrono::minutes(1));
+		m.postmarks = { uint32_t(rng()), uint32_t(rng()) };
+		msgs.push_back(std::move(m));
+	}
+	return msgs;
+}
+
+std::vector<PubSub::Message>& trace()
+{
+	static std::vector<PubSub::Message> msgs;
+	if (!msgs.empty() || g_trace.empty())
+		return msgs;
+
+	igzstream in(g_trace.c_str());
+	RecReader rd(in);
+	RecReader::Record r;
+	while (rd.next(r))
+	{
+		PubSub::Message m(PubSub::parseSubject(r.subject), r.payload, qpc_clock::duration(r.ttl));
+		m.age = decltype(m.age)(r.age);
+		std::stringstream postmarks(r.postmarks);
+		std::string p;
+		while (std::getline(postmarks, p, ','))
+			m.postmarks.push_back(uint32_t(strtoul(p.c_str(), nullptr, 10)));
+		msgs.push_back(std::move(m));
+	}
+	return msgs;
+}
+
+uint64_t payloadBytes(const std::vector<PubSub::Message>& msgs)
+{
+	uint64_t n = 0;
+	for (const PubSub::Message& m : msgs)
+		n += m.payload.size();
+	return n;
+}
+
+// A <Delta> policy for every subject with a keyframe every keyframeN
+// records. 0 leaves the encoder writing plain payloads
+void deltaPolicy(RecEncoder& encoder, uint32_t keyframeN)
+{
+	if (keyframeN)
+		encoder.configure(parseConfig(config(10, "<Delta><Policy Subject=\"*\" KeyframeN=\"" + std::to_string(keyframeN) + "\"/></Delta>")));
+}
+
+// Payload encoding and line formatting, as PSubLocal::writeRecord does before zlib
+void serialize(benchmark::State& state, const std::vector<PubSub::Message>& msgs, uint32_t keyframeN = 0)
+{
+	RecEncoder encoder;
+	deltaPolicy(encoder, keyframeN);
+	std::string field;
+	std::string line;
+	uint64_t lineBytes = 0;
+	size_t i = 0;
+	for (auto _ : state)
+	{
+		const PubSub::Message& m = msgs[i++ % msgs.size()];
+		encoder.encode(m, std::chrono::steady_clock::now(), field);
+		line.clear();
+		RecFormat::format(line, 12, m, field);
+		lineBytes += line.size() + 1;
+		benchmark::DoNotOptimize(line.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(int64_t(state.iterations() * payloadBytes(msgs) / msgs.size()));
+	state.counters["LineBytes"] = state.iterations() ? double(lineBytes) / state.iterations() : 0.0;
+}
+
+void payloadSizes(benchmark::internal::Benchmark* b)
+{
+	for (size_t size : PAYLOAD_SIZES)
+		b->Arg(int64_t(size));
+}
+
+// range(0) payload size, range(1) KeyframeN
+void deltaArgs(benchmark::internal::Benchmark* b)
+{
+	for (size_t size : DELTA_SIZES)
+		for (uint32_t keyframeN : DELTA_KEYFRAMES)
+			b->Args({ int64_t(size), int64_t(keyframeN) });
+}
+
+void BM_Serialize(benchmark::State& state)
+{
+	serialize(state, synthetic(size_t(state.range(0)), 256));
+}
+
+void BM_SerializeDelta(benchmark::State& state)
+{
+	serialize(state, evolving(size_t(state.range(0)), DELTA_MESSAGES), uint32_t(state.range(1)));
+}
+
+// Formatted lines through gzstreambuf into a file, the compression half of writeRecord
+void gzWrite(benchmark::State& state, const std::vector<PubSub::Message>& msgs, uint32_t keyframeN = 0)
+{
+	RecEncoder encoder;
+	deltaPolicy(encoder, keyframeN);
+	std::vector<std::string> lines;
+	uint64_t lineBytes = 0;
+	for (const PubSub::Message& m : msgs)
+	{
+		std::string field;
+		encoder.encode(m, std::chrono::steady_clock::now(), field);
+		lines.emplace_back();
+		RecFormat::format(lines.back(), 12, m, field);
+		lineBytes += lines.back().size() + 1;
+	}
+
+	std::string fname = scratch("gzwrite.rec.gz");
+	ogzstream strm(fname.c_str());
+	uint64_t raw = 0;
+	uint64_t payload = 0;  // message bytes behind the lines in the current file
+	size_t i = 0;
+	for (auto _ : state)
+	{
+		const PubSub::Message& m = msgs[i % msgs.size()];
+		const std::string& line = lines[i++ % lines.size()];
+		strm.write(line.data(), line.size()) << std::endl;
+
+		raw += line.size() + 1;
+		payload += m.payload.size();
+		if (raw > MAX_FILE_BYTES)
+		{
+			state.PauseTiming();
+			strm.close();
+			strm.open(fname.c_str());
+			raw = 0;
+			payload = 0;
+			state.ResumeTiming();
+		}
+	}
+
+	uint64_t compressed = uint64_t(strm.rdbuf()->compressed());
+	uint64_t written = uint64_t(strm.rdbuf()->written());
+	strm.close();
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(int64_t(state.iterations() * lineBytes / lines.size()));
+	state.counters["Ratio"] = compressed ? double(written) / compressed : 0.0;
+	state.counters["PayloadRatio"] = compressed ? double(payload) / compressed : 0.0;
+}
+
+void BM_GzWrite(benchmark::State& state)
+{
+	gzWrite(state, synthetic(size_t(state.range(0)), 256));
+}
+
+void BM_GzWriteDelta(benchmark::State& state)
+{
+	gzWrite(state, evolving(size_t(state.range(0)), DELTA_MESSAGES), uint32_t(state.range(1)));
+}
+
+// A status message to match, and events as an upload trigger would configure them
+struct MatchInput
+{
+	loggercfg::Logger cfg;
+	std::string body;
+
+	MatchInput(const std::string& events, size_t size)
+		: cfg(parseConfig(config(10, "<NewFile>" + events + "</NewFile>")))
+	{
+		std::mt19937 rng(1);
+		body = payload(rng, size);
+	}
+
+	const loggercfg::event_string_t& event() const { return cfg.NewFile().Event().front(); }
+};
+
+void BM_MatchXPath(benchmark::State& state)
+{
+	MatchInput in("<Event xpath=\"string(/Status/@State)\" regex=\"^(fault|stopped)$\">Bench.*</Event>", size_t(state.range(0)));
+	std::string error;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(EventMatch::payload(in.event(), in.body, error));
+	state.SetBytesProcessed(int64_t(state.iterations() * in.body.size()));
+}
+
+void BM_MatchRegex(benchmark::State& state)
+{
+	MatchInput in("<Event regex=\"State=.(fault|stopped)\">Bench.*</Event>", size_t(state.range(0)));
+	std::string error;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(EventMatch::payload(in.event(), in.body, error));
+	state.SetBytesProcessed(int64_t(state.iterations() * in.body.size()));
+}
+
+// One message against N trigger subjects, none of which match, so every
+// event is evaluated as the dispatcher does for all ordinary traffic
+void BM_SubjectTriggers(benchmark::State& state)
+{
+	std::stringstream events;
+	for (int64_t i = 0; i < state.range(0); ++i)
+		events << "<Event>Trigger.Unit" << i << ".*</Event>";
+	loggercfg::Logger cfg = parseConfig(config(10, "<NewFile>" + events.str() + "</NewFile>"));
+	PubSub::Subject subject = PubSub::parseSubject("Bench.Unit7.Status");
+
+	for (auto _ : state)
+	{
+		bool found = false;
+		for (const loggercfg::event_string_t& e : cfg.NewFile().Event())
+			if ((found = EventMatch::subject(e, subject)))
+				break;
+		benchmark::DoNotOptimize(found);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+void BM_SubjectTriggersTrace(benchmark::State& state, const std::vector<PubSub::Message>& msgs)
+{
+	std::set<std::string> subjects;
+	for (const PubSub::Message& m : msgs)
+		subjects.insert(PubSub::toString(m.subject));
+
+	// The trace's own subjects as triggers, so some messages match part way down the list
+	std::stringstream events;
+	size_t n = 0;
+	for (auto it = subjects.begin(); it != subjects.end() && n < MAX_TRACE_TRIGGERS; ++it, ++n)
+		events << "<Event>" << *it << "</Event>";
+	loggercfg::Logger cfg = parseConfig(config(10, "<NewFile>" + events.str() + "</NewFile>"));
+
+	size_t i = 0;
+	for (auto _ : state)
+	{
+		const PubSub::Message& m = msgs[i++ % msgs.size()];
+		bool found = false;
+		for (const loggercfg::event_string_t& e : cfg.NewFile().Event())
+			if ((found = EventMatch::subject(e, m.subject)))
+				break;
+		benchmark::DoNotOptimize(found);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// Closing a file with its TOP trailer, handing it to the outbox, applying
+// MaxFileCount and opening the next, through the same Rotation and Storage
+// calls as PSubLocal::initNewFile, with range(0) files retained
+void BM_Rotation(benchmark::State& state)
+{
+	uint32_t maxFiles = uint32_t(state.range(0));
+	BF::remove_all(scratch("rotation"));
+	BF::create_directories(scratch("rotation"));
+	loggercfg::Logger cfg = parseConfig(config(maxFiles,
+		"<FtpUpload Host=\"127.0.0.1\" path=\"/tmp\" username=\"bench\"><Event>Bench.Upload</Event></FtpUpload>"
+		"<TopK/>"));
+	Outbox outbox(logfile, cfg);
+	Storage::Policy policy = Storage::Policy::fromConfig(cfg);
+	SubjectTop top(cfg.TopK().Capacity());
+
+	std::mt19937 rng(1);
+	std::string line = payload(rng, 1024);
+	ogzstream strm;
+	std::string fname;
+	uint32_t n = 0;
+
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		for (int i = 0; i < 100; ++i)
+		{
+			strm << line << std::endl;
+			top.add("Bench.Subject." + std::to_string(i % 32), line.size());
+		}
+		state.ResumeTiming();
+
+		if (!fname.empty())
+		{
+			Rotation::trailer(strm, top.table(cfg.TopK().Size()));
+			Storage::close(strm, fname, policy);
+			outbox.add(fname);
+		}
+		top.clear();
+
+		Rotation::retain(cfg, &outbox);
+
+		std::stringstream name;
+		name << cfg.LogPath() << "/bench_" << std::setw(8) << std::setfill('0') << n++ << ".rec.gz";
+		fname = name.str();
+		if (Storage::open(strm, fname, policy))
+			strm << "START 20240101000000.0" << std::endl;
+	}
+	Storage::close(strm, fname, policy);
+	state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_Serialize)->Apply(payloadSizes);
+BENCHMARK(BM_GzWrite)->Apply(payloadSizes);
+BENCHMARK(BM_SerializeDelta)->Apply(deltaArgs);
+BENCHMARK(BM_GzWriteDelta)->Apply(deltaArgs);
+BENCHMARK(BM_MatchXPath)->Arg(256)->Arg(4096);
+BENCHMARK(BM_MatchRegex)->Arg(256)->Arg(4096);
+BENCHMARK(BM_SubjectTriggers)->Arg(1)->Arg(8)->Arg(64)->Arg(512);
+BENCHMARK(BM_Rotation)->Arg(10)->Arg(100)->Arg(1000)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char* argv[])
+{
+	// Our own options first; the rest go to the benchmark library
+	int n = 1;
+	for (int x = 1; x < argc; ++x)
+	{
+		if (strncmp(argv[x], "--trace=", 8) == 0)
+			g_trace = argv[x] + 8;
+		else if (strncmp(argv[x], "--work=", 7) == 0)
+			g_work = argv[x] + 7;
+		else
+			argv[n++] = argv[x];
+	}
+	argc = n;
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+
+	BF::create_directories(scratch());
+	logfile.open(scratch("bench.log"));
+
+	if (!g_trace.empty())
+	{
+		const std::vector<PubSub::Message>& msgs = trace();
+		if (msgs.empty())
+		{
+			std::cerr << "No records in " << g_trace << std::endl;
+			return 1;
+		}
+		std::cerr << "Trace: " << msgs.size() << " records, " << payloadBytes(msgs) << " payload bytes" << std::endl;
+
+		benchmark::RegisterBenchmark("BM_Serialize/trace", serialize, msgs, 0);
+		benchmark::RegisterBenchmark("BM_GzWrite/trace", gzWrite, msgs, 0);
+		benchmark::RegisterBenchmark("BM_SerializeDelta/trace", serialize, msgs, 100);
+		benchmark::RegisterBenchmark("BM_GzWriteDelta/trace", gzWrite, msgs, 100);
+		benchmark::RegisterBenchmark("BM_SubjectTriggers/trace", BM_SubjectTriggersTrace, msgs);
+	}
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	BF::remove_all(scratch());
+	return 0;
+}
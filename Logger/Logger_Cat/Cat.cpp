@@ -0,0 +1,146 @@
+
+#include "Logger/RecFormat.h"
+#include "Logger/gzstream.h"
+#include "Logger/TraceRing.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+void usage();
+bool parseCmdLine(int argc, char *argv[]);
+
+bool g_base64{false};
+bool g_markers{false};
+bool g_absolute{false};
+bool g_trace{false};
+std::vector<std::string> g_files;
+
+int main(int argc, char* argv[])
+{
+	if (!parseCmdLine(argc, argv))
+		return -1;
+
+	int ret = 0;
+	for (const std::string& f : g_files)
+	{
+		if (g_trace)
+		{
+			std::ifstream in(f, std::ios::binary);
+			if (!in.good())
+			{
+				std::cerr << "Unable to open " << f << std::endl;
+				ret = 1;
+			}
+			else if (!Trace::decode(in, std::cout))
+			{
+				std::cerr << f << " is not a trace dump" << std::endl;
+				ret = 1;
+			}
+			continue;
+		}
+
+		igzstream in(f.c_str());
+		if (!in.good())
+		{
+			std::cerr << "Unable to open " << f << std::endl;
+			ret = 1;
+			continue;
+		}
+
+		RecReader rd(in);
+		RecReader::Record r;
+		while (rd.next(r))
+		{
+			if (r.gapMsgs)
+				std::cout << "GAP " << r.gapMsgs << " messages " << r.gapBytes << " bytes dropped" << std::endl;
+
+			if (g_absolute)
+				std::cout << RecFormat::formatTime(std::chrono::system_clock::time_point(
+					std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(r.time))));
+			else
+				std::cout << r.tdiff;
+			std::cout << " " << r.age << " " << r.ttl << " " << r.postmarks << " " << r.subject << " ";
+			if (g_markers && r.unchanged)
+				std::cout << RecFormat::UNCHANGED;
+			else
+				std::cout << (g_base64 ? RecFormat::base64Encode(r.payload) : r.payload);
+			std::cout << std::endl;
+		}
+
+		if (rd.malformed())
+			std::cerr << f << ": " << rd.malformed() << " malformed records skipped" << std::endl;
+		if (rd.gapMsgs())
+			std::cerr << f << ": " << rd.gapMsgs() << " messages dropped by the recorder" << std::endl;
+		for (const RecReader::Top& t : rd.top())
+			std::cerr << f << ": top by " << t.by << " " << t.subject << " " << t.count << (t.error ? " (+" + std::to_string(t.error) + ")" : "") << std::endl;
+	}
+
+	return ret;
+}
+
+bool parseCmdLine(int argc, char *argv[])
+{
+	for (int x = 1; x < argc; ++x)
+	{
+		if (argv[x][0] == '-')
+		{
+			// an option
+			int optlen = strlen(argv[x]);
+			for (int y = 1; y < optlen; ++y)
+			{
+				switch (argv[x][y])
+				{
+				case 'h':
+					usage();
+					return false;
+				case 'b':
+					g_base64 = true;
+					break;
+				case 'm':
+					g_markers = true;
+					break;
+				case 'a':
+					g_absolute = true;
+					break;
+				case 'T':
+					g_trace = true;
+					break;
+				default:
+					std::cout << "Invalid command line parameters" << std::endl;
+					usage();
+					return false;
+				}
+			}
+		}
+		else
+			g_files.push_back(argv[x]);
+	}
+
+	if (g_files.empty())
+	{
+		usage();
+		return false;
+	}
+
+	return true;
+}
+
+void usage()
+{
+	using namespace std;
+	cout << "logcat - Decode pSub Logger record files" << endl;
+	cout << "Usage: logcat [OPTIONS] <file.rec.gz> [file.rec.gz...]" << endl;
+	cout << "Options:" << endl;
+	cout << "\t-h - help. Print this message and exit" << endl;
+	cout << "\t-b - base64. Print payloads base64 encoded as stored rather than raw" << endl;
+	cout << "\t-m - markers. Print unchanged markers as stored rather than expanding them" << endl;
+	cout << "\t-a - absolute. Print each record's UTC time, rebuilt from the START and TIME lines, in place of tdiff" << endl;
+	cout << "\t-T - trace. The files are trace.<pid>.<n>.bin dumps from SIGUSR1 or Logger.Dump; print their events" << endl;
+	cout << endl;
+	cout << "Each record is printed as: <tdiff> <age> <ttl> <postmarks> <subject> <payload>" << endl;
+	cout << "tdiff is in milliseconds, or the unit of the file's RES line; absolute times are yyyymmddhhmmss.nnnnnnnnn" << endl;
+	cout << "Each trace event is printed as: <UTC time> +<ms since the previous event> T<thread> <event> <values>" << endl;
+}
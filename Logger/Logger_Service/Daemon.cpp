@@ -1,8 +1,11 @@
 #include "Misc/signals.h"
 #include "Logging/Log.h"
 #include "Logger/Logger_Dispatcher.h"
+#include "Logger/TraceRing.h"
 #include "Task/lock.h"
 
+#include <signal.h>
+
 #define DAEMON_NAME "ccmloggerd"
 
 namespace Logging
@@ -48,6 +51,7 @@ int main(int argc, char* argv[])
 	}
 
 	VEvent& stopEvent = signalSetup();
+	Trace::dumpOnSignal(SIGUSR1);
 
 	if (!logfilen.empty())
 		logfile.open(logfilen);
@@ -0,0 +1,645 @@
+#include "Logging/Log.h"
+#include "HubApp/HubApp.h"
+#include "Task/TTask.h"
+#include "Logger/RecFormat.h"
+#include "Logger/gzstream.h"
+#include "pugixml/pugixml.hpp"
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Load and soak test for ccmloggerd. Runs the daemon in exe mode against a
+// psub hub, publishes synthetic traffic through the same hub and reads the
+// record files back to check that every message landed. Rates step up until
+// the logger stops keeping up, or hold for -L seconds for a soak.
+//
+// A step is sustained when the logger dropped nothing, its ingest queue never
+// held more than 100ms of traffic and the publisher managed the offered rate.
+
+typedef std::chrono::steady_clock bclock;
+
+void usage();
+bool parseCmdLine(int argc, char *argv[]);
+
+std::string g_version = "1.0.0";
+
+std::string g_bus("127.0.0.1");
+std::string g_daemon("./ccmloggerd");
+std::string g_work("/tmp/soak");
+
+// Left in the working directory, so a later run knows it may empty it
+const char* WORK_MARKER = ".soak";
+std::string g_sizes("fixed:256");
+uint32_t g_subjects{100};
+uint32_t g_rate{1000};
+uint32_t g_growth{50};
+uint32_t g_maxRate{200000};
+uint32_t g_stepS{10};
+uint32_t g_soakS{0};
+
+Logging::LogFile logfile;
+
+const PubSub::Subject SUB_CFG{ "CFG", "Logger" };
+const PubSub::Subject SUB_NEW_FILE{ "Logger", "Newfile" };
+const PubSub::Subject SUB_METRICS{ "Status", "Logger", "Metrics" };
+
+constexpr qpc_clock::duration TTL_CFG{std::chrono::hours(-12)}; // retained until superseded
+constexpr qpc_clock::duration TTL_SOAK{std::chrono::minutes(1)};
+
+const char* SUBJECT_ROOT = "Soak";
+const char* STAGES[] = { "Bus", "Queue", "Serialize", "Compress", "Durable" };
+
+// Payload sizes: fixed:<n>, uniform:<min>-<max> or lognormal:<median>,<sigma>
+class Sizes
+{
+public:
+	bool parse(const std::string& spec)
+	{
+		if (sscanf(spec.c_str(), "fixed:%lf", &m_a) == 1)
+			m_kind = FIXED;
+		else if (sscanf(spec.c_str(), "uniform:%lf-%lf", &m_a, &m_b) == 2 && m_b >= m_a)
+			m_kind = UNIFORM;
+		else if (sscanf(spec.c_str(), "lognormal:%lf,%lf", &m_a, &m_b) == 2 && m_a > 0)
+			m_kind = LOGNORMAL;
+		else
+			return false;
+		return true;
+	}
+
+	size_t next(std::mt19937_64& rng)
+	{
+		double v = m_a;
+		if (m_kind == UNIFORM)
+			v = std::uniform_real_distribution<double>(m_a, m_b)(rng);
+		else if (m_kind == LOGNORMAL)
+			v = std::lognormal_distribution<double>(log(m_a), m_b)(rng);
+		return size_t(std::min(v, 16.0 * 1024 * 1024));
+	}
+
+private:
+	enum { FIXED, UNIFORM, LOGNORMAL } m_kind{FIXED};
+	double m_a{256};
+	double m_b{0};
+};
+
+// What the logger's Metrics messages showed over one step
+struct StepMetrics
+{
+	uint64_t messages{0};
+	uint64_t queueDepth{0};
+	uint64_t peakQueueDepth{0};
+	uint64_t queueDropped{0};
+	uint64_t msgsWritten{0};
+	uint64_t rotations{0};
+	std::map<std::string, uint64_t> worstP99;
+	std::map<std::string, uint64_t> worstMax;
+};
+
+// The harness's own connection to the hub
+class SoakClient : public Task::TActiveTask<SoakClient>, public Logging::LogClient
+{
+	friend HubApps::HubApp;
+	HubApps::HubApp m_hub;
+	void receiveEvent(PubSub::Message&& msg) { enqueue<PubSub::Message&&>(std::move(msg)); }
+	void receiveUnknown(uint8_t, const std::string&) {}
+	void eventBusConnected(HubApps::HubConnectionState state)
+	{
+		if (state != HubApps::HubConnectionState::HubAvailable)
+			return;
+
+		m_hub.subscribe(SUB_METRICS);
+		std::lock_guard<std::mutex> s(m_lk);
+		m_connected = true;
+		m_cv.notify_all();
+	}
+
+	std::mutex m_lk;
+	std::condition_variable m_cv;
+	bool m_connected{false};
+	StepMetrics m_step;
+
+public:
+	SoakClient(Logging::LogFile& log, const std::string& psubAddr)
+		: Task::TActiveTask<SoakClient>(1)
+		, Logging::LogClient(log)
+		, m_hub(*this, psubAddr)
+	{
+		m_hub.start();
+		getMsgDispatcher().start();
+	}
+
+	~SoakClient()
+	{
+		getMsgDispatcher().stop();
+		m_hub.stop();
+	}
+
+	constexpr const char* appName() const { return "Soak"; }
+	constexpr std::string& version() const { return g_version; }
+
+	void send(const PubSub::Message& m) { m_hub.sendMsg(m); }
+
+	bool waitConnected(std::chrono::seconds timeout)
+	{
+		std::unique_lock<std::mutex> s(m_lk);
+		return m_cv.wait_for(s, timeout, [this]() { return m_connected; });
+	}
+
+	// Waits for a Metrics message after those seen so far
+	bool waitMetrics(std::chrono::seconds timeout, StepMetrics& m)
+	{
+		std::unique_lock<std::mutex> s(m_lk);
+		uint64_t seen = m_step.messages;
+		bool ok = m_cv.wait_for(s, timeout, [this, seen]() { return m_step.messages > seen; });
+		m = m_step;
+		return ok;
+	}
+
+	// Starts collecting a new step, carrying over the running totals
+	StepMetrics beginStep()
+	{
+		std::lock_guard<std::mutex> s(m_lk);
+		StepMetrics prev = m_step;
+		m_step.peakQueueDepth = m_step.queueDepth;
+		m_step.worstP99.clear();
+		m_step.worstMax.clear();
+		return prev;
+	}
+
+	StepMetrics step()
+	{
+		std::lock_guard<std::mutex> s(m_lk);
+		return m_step;
+	}
+
+	void processMsg(PubSub::Message&& m)
+	{
+		if (!PubSub::match(SUB_METRICS, m.subject))
+			return;
+
+		pugi::xml_document doc;
+		pugi::xml_parse_result r = doc.load_string(m.payload.c_str());
+		if (r.status != pugi::xml_parse_status::status_ok)
+			return;
+		pugi::xml_node metrics = doc.child("Metrics");
+
+		std::lock_guard<std::mutex> s(m_lk);
+		++m_step.messages;
+		m_step.queueDepth = uint64_t(metrics.attribute("QueueDepth").as_double());
+		m_step.peakQueueDepth = std::max(m_step.peakQueueDepth, m_step.queueDepth);
+		m_step.queueDropped = uint64_t(metrics.attribute("QueueDropped").as_double());
+		m_step.msgsWritten = uint64_t(metrics.attribute("MsgsWritten").as_double());
+		m_step.rotations = uint64_t(metrics.attribute("Rotations").as_double());
+		for (pugi::xml_node l : metrics.children("Latency"))
+		{
+			std::string stage = l.attribute("Stage").value();
+			m_step.worstP99[stage] = std::max(m_step.worstP99[stage], uint64_t(l.attribute("P99").as_double()));
+			m_step.worstMax[stage] = std::max(m_step.worstMax[stage], uint64_t(l.attribute("Max").as_double()));
+		}
+		m_cv.notify_all();
+	}
+};
+
+std::string config()
+{
+	std::stringstream strm;
+	strm << "<Logger>"
+		<< "<LogPath>" << g_work << "/rec</LogPath>"
+		<< "<FileNameRoot>soak</FileNameRoot>"
+		<< "<MaxFileCount>100000</MaxFileCount>"
+		<< "<NewFile Count=\"100000\"/>"
+		<< "<Metrics IntervalS=\"1\"/>"
+		<< "<Timestamps Resolution=\"us\"/>"
+		<< "</Logger>";
+	return strm.str();
+}
+
+pid_t startLogger()
+{
+	std::string exe = BF::absolute(g_daemon).string();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		if (chdir(g_work.c_str()) == 0)
+			execl(exe.c_str(), exe.c_str(), "-e", "-b", g_bus.c_str(), "-l", "ccmloggerd.log", (char*)nullptr);
+		_exit(127);
+	}
+	return pid;
+}
+
+bool stopLogger(pid_t pid)
+{
+	kill(pid, SIGTERM);
+	for (int i = 0; i < 300; ++i)
+	{
+		int status = 0;
+		if (waitpid(pid, &status, WNOHANG) == pid)
+			return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+	return false;
+}
+
+// Resident set in KB, 0 once the process has gone
+uint64_t rss(pid_t pid)
+{
+	std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			return strtoull(line.c_str() + 6, nullptr, 10);
+	return 0;
+}
+
+uint64_t wallUs()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Publishes numbered messages across the subjects. Each payload carries its
+// sequence number and publish time so the records can be matched up later
+class Publisher
+{
+public:
+	Publisher(SoakClient& client, const Sizes& sizes)
+		: m_client(client), m_sizes(sizes), m_rng(1)
+	{
+		for (uint32_t i = 0; i < g_subjects; ++i)
+			m_subjects.push_back(PubSub::Subject{ SUBJECT_ROOT, "S" + std::to_string(i) });
+
+		// Fill that compresses about as well as real payloads
+		std::uniform_int_distribution<int> digit(0, 15);
+		for (int i = 0; i < 64 * 1024; ++i)
+			m_fill += "0123456789abcdef"[digit(m_rng)];
+	}
+
+	void publish()
+	{
+		std::string payload = "<Soak Seq=\"" + std::to_string(m_seq) + "\" At=\"" + std::to_string(wallUs()) + "\">";
+		size_t size = m_sizes.next(m_rng);
+		while (payload.size() + 7 < size)
+			payload.append(m_fill, m_rng() % (m_fill.size() / 2), std::min(size - payload.size() - 7, m_fill.size() / 2));
+		payload += "</Soak>";
+
+		m_client.send(PubSub::Message{ m_subjects[m_seq % m_subjects.size()], payload, TTL_SOAK });
+		++m_seq;
+		m_bytes += payload.size();
+	}
+
+	uint64_t published() const { return m_seq; }
+	uint64_t bytes() const { return m_bytes; }
+
+private:
+	SoakClient& m_client;
+	Sizes m_sizes;
+	std::mt19937_64 m_rng;
+	std::vector<PubSub::Subject> m_subjects;
+	std::string m_fill;
+	uint64_t m_seq{0};
+	uint64_t m_bytes{0};
+};
+
+struct StepResult
+{
+	double offered{0};
+	double achieved{0};
+	uint64_t dropped{0};
+	uint64_t peakQueue{0};
+	uint64_t rssStart{0};
+	uint64_t rssEnd{0};
+	uint64_t rssMax{0};
+	bool drained{false};
+	bool sustained{false};
+	StepMetrics metrics;
+};
+
+StepResult runStep(SoakClient& client, Publisher& pub, pid_t pid, double rate, std::chrono::seconds duration, std::ofstream& rssLog, bclock::time_point epoch)
+{
+	StepResult r;
+	r.offered = rate;
+	StepMetrics before = client.beginStep();
+	r.rssStart = r.rssMax = rss(pid);
+
+	uint64_t sent = 0;
+	auto start = bclock::now();
+	auto end = start + duration;
+	auto sample = start + std::chrono::seconds(1);
+	for (auto now = start; now < end; now = bclock::now())
+	{
+		uint64_t due = uint64_t(rate * std::chrono::duration<double>(now - start).count());
+		while (sent < due && bclock::now() < end)
+		{
+			pub.publish();
+			++sent;
+		}
+
+		if (now >= sample)
+		{
+			uint64_t kb = rss(pid);
+			r.rssMax = std::max(r.rssMax, kb);
+			rssLog << std::fixed << std::setprecision(1) << std::chrono::duration<double>(now - epoch).count()
+				<< "," << rate << "," << kb << "," << client.step().queueDepth << std::endl;
+			sample += std::chrono::seconds(1);
+		}
+
+		if (sent >= due)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	r.achieved = sent / std::chrono::duration<double>(bclock::now() - start).count();
+
+	// Let the logger catch up before judging the step
+	StepMetrics m;
+	auto drainBy = bclock::now() + std::chrono::seconds(10);
+	while (bclock::now() < drainBy && client.waitMetrics(std::chrono::seconds(3), m))
+		if (!m.queueDepth && m.msgsWritten >= before.msgsWritten + sent)
+		{
+			r.drained = true;
+			break;
+		}
+
+	r.metrics = client.step();
+	r.rssEnd = rss(pid);
+	r.dropped = r.metrics.queueDropped - before.queueDropped;
+	r.peakQueue = r.metrics.peakQueueDepth;
+	r.sustained = r.drained && !r.dropped && r.peakQueue <= std::max(1.0, rate / 10) && r.achieved >= rate * 0.99;
+	return r;
+}
+
+void report(uint32_t n, const StepResult& r)
+{
+	std::cout << "Step " << n << ": " << std::fixed << std::setprecision(0) << r.offered << " msg/s offered, " << r.achieved << " published"
+		<< ", dropped " << r.dropped << ", peak queue " << r.peakQueue
+		<< std::setprecision(1) << ", RSS " << r.rssStart / 1024.0 << " -> " << r.rssEnd / 1024.0 << " MB (max " << r.rssMax / 1024.0 << ")";
+	for (const char* s : STAGES)
+		if (r.metrics.worstP99.count(s))
+			std::cout << ", " << s << " p99 " << r.metrics.worstP99.at(s) << "us";
+	std::cout << (r.sustained ? " - sustained" : r.drained ? " - NOT sustained" : " - NOT sustained, did not drain") << std::endl;
+}
+
+double percentile(std::vector<double> v, double p)
+{
+	if (v.empty())
+		return 0.0;
+	std::sort(v.begin(), v.end());
+	return v[std::min(v.size() - 1, size_t(p * v.size()))];
+}
+
+uint64_t attr(const std::string& payload, const char* name)
+{
+	std::string key = std::string(name) + "=\"";
+	size_t p = payload.find(key);
+	return p == std::string::npos ? UINT64_MAX : strtoull(payload.c_str() + p + key.size(), nullptr, 10);
+}
+
+// Reads every record file back and checks each published message is there once
+bool verify(uint64_t published)
+{
+	std::vector<uint8_t> seen(published);
+	std::vector<double> latencyMs;
+	uint64_t records = 0, gaps = 0, malformed = 0, foreign = 0;
+
+	std::vector<BF::path> files;
+	for (const BF::path& dir : { BF::path(g_work) / "rec", BF::path(g_work) / "rec" / "outbox" })
+		if (BF::is_directory(dir))
+			for (BF::directory_entry d : BF::directory_iterator(dir))
+				if (d.path().filename().string().find(".rec.gz") != std::string::npos)
+					files.push_back(d.path());
+	std::sort(files.begin(), files.end());
+
+	std::string root = std::string(SUBJECT_ROOT) + ".";
+	for (const BF::path& f : files)
+	{
+		igzstream in(f.string().c_str());
+		RecReader rd(in);
+		RecReader::Record r;
+		while (rd.next(r))
+		{
+			bool timed = r.time > 0;
+			uint64_t at = uint64_t(r.time / 1000);
+
+			if (r.subject.compare(0, root.size(), root) != 0)
+				continue;
+			++records;
+
+			uint64_t seq = attr(r.payload, "Seq");
+			uint64_t sent = attr(r.payload, "At");
+			if (seq >= published)
+			{
+				++foreign;
+				continue;
+			}
+			if (seen[seq] < 255)
+				++seen[seq];
+			if (timed && sent != UINT64_MAX)
+				latencyMs.push_back(at > sent ? (at - sent) / 1000.0 : 0.0);
+		}
+		gaps += rd.gapMsgs();
+		malformed += rd.malformed();
+	}
+
+	uint64_t missing = uint64_t(std::count(seen.begin(), seen.end(), 0));
+	uint64_t duplicated = uint64_t(std::count_if(seen.begin(), seen.end(), [](uint8_t n) { return n > 1; }));
+
+	// Drops the logger reported in GAP lines are expected of an unsustained
+	// step; only losses beyond them are a fault. GAP counts every subject, so
+	// this is lenient when other publishers are dropped too
+	uint64_t unreported = missing > gaps ? missing - gaps : 0;
+
+	std::cout << "Verify: " << published << " published, " << records << " recorded in " << files.size() << " files, "
+		<< missing << " missing (" << gaps << " reported dropped, " << unreported << " not), " << duplicated << " duplicated";
+	if (malformed || foreign)
+		std::cout << ", " << malformed << " malformed, " << foreign << " from an earlier run";
+	std::cout << std::endl;
+
+	if (!latencyMs.empty())
+		std::cout << "Publish to record, from record times: p50 " << std::fixed << std::setprecision(3) << percentile(latencyMs, 0.5)
+			<< "ms p99 " << percentile(latencyMs, 0.99) << "ms p99.9 " << percentile(latencyMs, 0.999)
+			<< "ms max " << percentile(latencyMs, 1.0) << "ms" << std::endl;
+
+	return !unreported && !duplicated;
+}
+
+int main(int argc, char* argv[])
+{
+	if (!parseCmdLine(argc, argv))
+		return -1;
+
+	Sizes sizes;
+	if (!sizes.parse(g_sizes))
+	{
+		std::cout << "Invalid size distribution " << g_sizes << std::endl;
+		usage();
+		return -1;
+	}
+
+	// Only a directory this harness made, or an empty one, is emptied
+	boost::system::error_code ec;
+	if (BF::exists(g_work) && !BF::is_empty(g_work, ec) && !BF::exists(BF::path(g_work) / WORK_MARKER))
+	{
+		std::cout << g_work << " is not empty and was not made by soak. Give -w an empty or new directory" << std::endl;
+		return 1;
+	}
+
+	BF::remove_all(g_work);
+	BF::create_directories(BF::path(g_work) / "rec");
+	std::ofstream(BF::path(BF::path(g_work) / WORK_MARKER).string());
+	logfile.open((BF::path(g_work) / "soak.log").string());
+
+	SoakClient client(logfile, g_bus);
+	if (!client.waitConnected(std::chrono::seconds(10)))
+	{
+		std::cout << "No psub hub at " << g_bus << std::endl;
+		return 1;
+	}
+
+	// Retained, so the logger picks it up when it subscribes
+	client.send(PubSub::Message{ SUB_CFG, config(), TTL_CFG });
+
+	pid_t pid = startLogger();
+	if (pid < 0)
+	{
+		std::cout << "Unable to start " << g_daemon << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	StepMetrics m;
+	if (!client.waitMetrics(std::chrono::seconds(15), m))
+	{
+		std::cout << g_daemon << " did not come up. See " << g_work << "/ccmloggerd.log" << std::endl;
+		stopLogger(pid);
+		return 1;
+	}
+
+	std::ofstream rssLog((BF::path(g_work) / "rss.csv").string());
+	rssLog << "seconds,rate,rss_kb,queue_depth" << std::endl;
+
+	Publisher pub(client, sizes);
+	auto epoch = bclock::now();
+	double best = 0;
+	if (g_soakS)
+	{
+		std::cout << "Soak at " << g_rate << " msg/s for " << g_soakS << "s, " << g_subjects << " subjects, sizes " << g_sizes << std::endl;
+		StepResult r = runStep(client, pub, pid, g_rate, std::chrono::seconds(g_soakS), rssLog, epoch);
+		report(1, r);
+		if (r.sustained)
+			best = g_rate;
+	}
+	else
+	{
+		std::cout << "Ramp from " << g_rate << " msg/s by " << g_growth << "% every " << g_stepS << "s, " << g_subjects
+			<< " subjects, sizes " << g_sizes << std::endl;
+		uint32_t n = 0;
+		for (double rate = g_rate; rate <= g_maxRate; rate *= 1.0 + g_growth / 100.0)
+		{
+			StepResult r = runStep(client, pub, pid, rate, std::chrono::seconds(g_stepS), rssLog, epoch);
+			report(++n, r);
+			if (!r.sustained)
+				break;
+			best = rate;
+		}
+	}
+	std::cout << "Max sustained: " << std::fixed << std::setprecision(0) << best << " msg/s, "
+		<< std::setprecision(1) << (pub.published() ? pub.bytes() / double(pub.published()) : 0.0) << " bytes average payload" << std::endl;
+
+	// Close the current file so all of it is readable, then stop
+	client.beginStep();
+	uint64_t rotations = client.step().rotations;
+	client.send(PubSub::Message{ SUB_NEW_FILE, "", TTL_SOAK });
+	for (int i = 0; i < 10 && client.waitMetrics(std::chrono::seconds(3), m) && m.rotations <= rotations; ++i)
+		;
+	if (!stopLogger(pid))
+		std::cout << "ccmloggerd did not exit cleanly" << std::endl;
+
+	std::cout << "RSS over time in " << g_work << "/rss.csv" << std::endl;
+	return verify(pub.published()) ? 0 : 1;
+}
+
+bool parseCmdLine(int argc, char *argv[])
+{
+	std::map<char, std::string*> strings{ {'b', &g_bus}, {'x', &g_daemon}, {'w', &g_work}, {'z', &g_sizes} };
+	std::map<char, uint32_t*> numbers{ {'S', &g_subjects}, {'r', &g_rate}, {'g', &g_growth}, {'m', &g_maxRate},
+		{'D', &g_stepS}, {'L', &g_soakS} };
+
+	for (int x = 1; x < argc; ++x)
+	{
+		if (argv[x][0] != '-' || strlen(argv[x]) != 2)
+		{
+			std::cout << "Invalid command line parameters" << std::endl;
+			usage();
+			return false;
+		}
+
+		char opt = argv[x][1];
+		if (opt == 'h')
+		{
+			usage();
+			return false;
+		}
+		if (++x >= argc || (!strings.count(opt) && !numbers.count(opt)))
+		{
+			std::cout << "Invalid command line parameters" << std::endl;
+			usage();
+			return false;
+		}
+
+		if (strings.count(opt))
+			*strings[opt] = argv[x];
+		else
+			*numbers[opt] = uint32_t(strtoul(argv[x], nullptr, 10));
+	}
+
+	if (g_work.empty() || !g_subjects || !g_rate || !g_stepS || (!g_soakS && !g_growth))
+	{
+		usage();
+		return false;
+	}
+
+	return true;
+}
+
+void usage()
+{
+	using namespace std;
+	cout << "soak - Load and soak test ccmloggerd through a psub hub" << endl;
+	cout << "Usage: soak [OPTIONS]" << endl;
+	cout << "Start a psub hub first. The logger is configured over the bus, so no other" << endl;
+	cout << "configuration publisher should be running." << endl;
+	cout << "Options:" << endl;
+	cout << "\t-h - help. Print this message and exit" << endl;
+	cout << "\t-b address - psub hub. Default 127.0.0.1" << endl;
+	cout << "\t-x path - ccmloggerd to run. Default ./ccmloggerd" << endl;
+	cout << "\t-w dir - working directory for records and logs. Must be empty, new or from an earlier run, which is emptied. Default /tmp/soak" << endl;
+	cout << "\t-S count - subjects published on. Default 100" << endl;
+	cout << "\t-z spec - payload sizes: fixed:<bytes>, uniform:<min>-<max> or lognormal:<median>,<sigma>. Default fixed:256" << endl;
+	cout << "\t-r msg/s - first step's rate, or the soak rate. Default 1000" << endl;
+	cout << "\t-g percent - rate increase per step. Default 50" << endl;
+	cout << "\t-m msg/s - highest rate tried. Default 200000" << endl;
+	cout << "\t-D seconds - step length. Default 10" << endl;
+	cout << "\t-L seconds - soak at -r for this long instead of ramping" << endl;
+	cout << endl;
+	cout << "A step is sustained when nothing is dropped, the ingest queue stays under 100ms" << endl;
+	cout << "of traffic and drains afterwards. Latency per stage is the logger's own, worst" << endl;
+	cout << "p99 over the step. RSS is sampled every second into rss.csv." << endl;
+}
@@ -0,0 +1,438 @@
+#include "Logging/Log.h"
+#include "Logger/configuration-pimpl.hxx"
+#include "Logger/Histogram.h"
+#include "Logger/RecFormat.h"
+#include "Logger/Rotation.h"
+#include "Logger/Storage.h"
+#include "Logger/TopK.h"
+#include "Logger/gzstream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Storage path benchmark. Writes records at a fixed rate into a directory the
+// way the writer does, through Storage and Rotation, flushing every -f ms and
+// rotating every -n records, for each combination of zlib buffer size,
+// compression level, fsync and cache dropping given. Run it on each target
+// medium (SD card, eMMC, tmpfs) to choose the <Storage> and <Flush> settings
+// for it.
+//
+// Reported per configuration:
+//   the rate achieved and the raw and on disk throughput,
+//   the time to write a record, flush and rotate, as p50, p99 and max,
+//   how far behind schedule the writer fell,
+//   the page cache held by the record files, at its peak and once all are closed.
+
+typedef std::chrono::steady_clock bclock;
+
+void usage();
+bool parseCmdLine(int argc, char *argv[]);
+
+std::string g_version = "1.0.0";
+
+std::string g_work("/tmp");
+std::string g_trace;
+std::string g_csv;
+std::string g_buffers("8192,65536");
+std::string g_levels("1,6");
+std::string g_fsyncs("0,1");
+std::string g_drops("0");
+uint32_t g_rate{2000};
+uint32_t g_size{256};
+uint32_t g_seconds{10};
+uint32_t g_perFile{100000};
+uint32_t g_flushMs{1000};
+uint32_t g_keep{10};
+uint32_t g_topK{1000};
+
+Logging::LogFile logfile;
+
+// Distinct lines written in turn. Enough that zlib cannot just match the last one
+const size_t LINES = 4096;
+
+// A record line and what the writer's TopK counts for it
+struct Line
+{
+	std::string text;
+	std::string subject;
+	size_t bytes;
+};
+
+struct Config
+{
+	unsigned buffer;
+	unsigned level;
+	bool fsync;
+	bool drop;
+};
+
+struct Result
+{
+	uint64_t records{0};
+	double seconds{0.0};
+	uint64_t raw{0};
+	uint64_t compressed{0};
+	Histogram write;
+	Histogram flush;
+	Histogram rotate;
+	uint64_t behindUs{0};
+	uint64_t cachePeak{0};
+	uint64_t cacheEnd{0};
+};
+
+std::vector<unsigned> parseList(const std::string& s)
+{
+	std::vector<unsigned> r;
+	std::istringstream strm(s);
+	std::string item;
+	while (std::getline(strm, item, ','))
+		if (!item.empty())
+			r.push_back(unsigned(strtoul(item.c_str(), nullptr, 10)));
+	return r;
+}
+
+uint64_t usSince(bclock::time_point t)
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(bclock::now() - t).count());
+}
+
+// Status like payloads: attribute names repeat, values vary, as on the bus
+std::vector<Line> syntheticLines()
+{
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> value(0, 99999);
+	const char* names[] = { "Speed", "Heading", "Lat", "Lon", "Odometer", "Door", "Load", "Temp" };
+
+	std::vector<Line> lines;
+	for (size_t i = 0; i < LINES; ++i)
+	{
+		PubSub::Message m;
+		m.subject = PubSub::Subject{ "Bench", "S" + std::to_string(i % 50) };
+		m.payload = "<Status Seq=\"" + std::to_string(i) + "\"";
+		while (m.payload.size() + 3 < g_size)
+			m.payload += std::string(" ") + names[value(rng) % 8] + "=\"" + std::to_string(value(rng)) + "\"";
+		m.payload += "/>";
+
+		std::string line;
+		RecFormat::format(line, value(rng) % 100, m, RecFormat::base64Encode(m.payload));
+		lines.push_back(Line{ line, PubSub::toString(m.subject), m.payload.size() });
+	}
+	return lines;
+}
+
+// The records of a captured file, as they were written
+std::vector<Line> traceLines()
+{
+	std::vector<Line> lines;
+	igzstream in(g_trace.c_str());
+	RecReader rd(in);
+	RecReader::Record r;
+	while (lines.size() < LINES * 16 && rd.next(r))
+	{
+		PubSub::Message m;
+		m.subject = PubSub::parseSubject(r.subject);
+		m.payload = r.payload;
+		std::string line;
+		RecFormat::format(line, r.tdiff, m, RecFormat::base64Encode(r.payload));
+		lines.push_back(Line{ line, r.subject, r.payload.size() });
+	}
+	return lines;
+}
+
+uint64_t cachedTotal(const std::deque<std::string>& files)
+{
+	uint64_t bytes = 0;
+	for (const std::string& f : files)
+		bytes += Storage::cached(f);
+	return bytes;
+}
+
+// What the writer is configured with apart from <Storage>, which run() sets
+loggercfg::Logger loggerConfig(const std::string& dir)
+{
+	std::ostringstream xml;
+	xml << "<Logger><LogPath>" << dir << "</LogPath><FileNameRoot>bench_</FileNameRoot><MaxFileCount>" << g_keep << "</MaxFileCount>";
+	if (g_topK)
+		xml << "<TopK Capacity=\"" << g_topK << "\"/>";
+	xml << "</Logger>";
+
+	loggercfg::Logger cfg;
+	loggercfg::Logger_paggr s;
+	xml_schema::document_pimpl d(s.root_parser(), s.root_name());
+	std::istringstream strm(xml.str());
+	s.pre();
+	d.parse(strm);
+	std::unique_ptr<loggercfg::Logger>{s.post()}->_copy(cfg);
+	return cfg;
+}
+
+void run(const Config& c, const std::vector<Line>& lines, const loggercfg::Logger& cfg, Result& res)
+{
+	Storage::Policy p;
+	p.bufferBytes = c.buffer;
+	p.level = int(c.level);
+	p.fsync = c.fsync;
+	p.dropCache = c.drop;
+
+	std::unique_ptr<SubjectTop> top;
+	if (cfg.TopK_present())
+		top.reset(new SubjectTop(cfg.TopK().Capacity()));
+
+	std::deque<std::string> files;
+	ogzstream strm;
+	uint64_t fileNo = 0;
+	auto openNext = [&]() {
+		// Zero padded, so name order is age order as with the writer's timestamps
+		std::ostringstream name;
+		name << cfg.LogPath() << "/bench_" << std::setw(8) << std::setfill('0') << fileNo++ << ".rec.gz";
+		files.push_back(name.str());
+		Storage::open(strm, files.back(), p);
+		strm << "START 0" << std::endl;
+	};
+
+	openNext();
+	bclock::time_point start = bclock::now();
+	bclock::time_point end = start + std::chrono::seconds(g_seconds);
+	bclock::time_point nextFlush = start + std::chrono::milliseconds(g_flushMs);
+	bclock::time_point nextCache = start + std::chrono::seconds(1);
+	std::chrono::nanoseconds period(g_rate ? 1000000000 / g_rate : 0);
+	uint32_t inFile = 0;
+
+	for (uint64_t i = 0;; ++i)
+	{
+		bclock::time_point due = start + period * i;
+		bclock::time_point now = bclock::now();
+		if (now >= end)
+			break;
+		if (now < due)
+		{
+			std::this_thread::sleep_until(due);
+			now = bclock::now();
+		}
+		else if (g_rate)
+			res.behindUs = std::max<uint64_t>(res.behindUs, uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(now - due).count()));
+
+		// As PSubLocal::writeRecord
+		const Line& line = lines[i % lines.size()];
+		strm.write(line.text.data(), line.text.size()) << std::endl;
+		if (top)
+			top->add(line.subject, line.bytes);
+		res.write.record(usSince(now));
+		res.raw += line.text.size() + 1;
+		++res.records;
+
+		// As PSubLocal::initNewFile: the TOP trailer, close, prune the oldest
+		// and open the next
+		if (++inFile >= g_perFile)
+		{
+			bclock::time_point t = bclock::now();
+			if (top)
+				Rotation::trailer(strm, top->table(cfg.TopK().Size()));
+			Storage::close(strm, files.back(), p);
+			res.compressed += uint64_t(BF::file_size(files.back()));
+			if (top)
+				top->clear();
+			Rotation::retain(cfg, nullptr);
+			while (!files.empty() && !BF::exists(files.front()))
+				files.pop_front();
+			openNext();
+			res.rotate.record(usSince(t));
+			inFile = 0;
+		}
+
+		if (bclock::now() >= nextFlush)
+		{
+			bclock::time_point t = bclock::now();
+			Storage::flush(strm, files.back(), p);
+			res.flush.record(usSince(t));
+			nextFlush += std::chrono::milliseconds(g_flushMs);
+		}
+
+		if (bclock::now() >= nextCache)
+		{
+			res.cachePeak = std::max(res.cachePeak, cachedTotal(files));
+			nextCache += std::chrono::seconds(1);
+		}
+	}
+
+	Storage::close(strm, files.back(), p);
+	res.compressed += uint64_t(BF::file_size(files.back()));
+	res.seconds = std::chrono::duration<double>(bclock::now() - start).count();
+	res.cacheEnd = cachedTotal(files);
+	res.cachePeak = std::max(res.cachePeak, res.cacheEnd);
+}
+
+std::string percentiles(const Histogram& h, double scale)
+{
+	Histogram::Snapshot s = h.snapshot();
+	std::ostringstream strm;
+	strm << std::fixed << std::setprecision(scale > 1 ? 1 : 0)
+		<< s.percentile(0.5) / scale << "/" << s.percentile(0.99) / scale << "/" << s.max / scale;
+	return strm.str();
+}
+
+int main(int argc, char* argv[])
+{
+	if (!parseCmdLine(argc, argv))
+		return -1;
+
+	std::vector<Line> lines = g_trace.empty() ? syntheticLines() : traceLines();
+	if (lines.empty())
+	{
+		std::cerr << "No records in " << g_trace << std::endl;
+		return 1;
+	}
+
+	std::vector<Config> configs;
+	for (unsigned b : parseList(g_buffers))
+		for (unsigned l : parseList(g_levels))
+			for (unsigned f : parseList(g_fsyncs))
+				for (unsigned d : parseList(g_drops))
+					configs.push_back(Config{ b, std::min(l, 9u), f != 0, d != 0 });
+
+	std::string dir = g_work + "/storagebench";
+	std::ofstream csv;
+	if (!g_csv.empty())
+	{
+		csv.open(g_csv);
+		csv << "buffer,level,fsync,drop_cache,rate,achieved,raw_mbps,disk_mbps,ratio,"
+			<< "write_p50_us,write_p99_us,write_max_us,flush_p50_us,flush_p99_us,flush_max_us,"
+			<< "rotate_p50_us,rotate_p99_us,rotate_max_us,behind_max_us,cache_peak_kb,cache_end_kb" << std::endl;
+	}
+
+	std::cout << "Writing " << (g_trace.empty() ? "synthetic " + std::to_string(g_size) + " byte payloads" : g_trace)
+		<< " to " << dir << " at " << (g_rate ? std::to_string(g_rate) + " msg/s" : "full speed") << " for " << g_seconds
+		<< "s per configuration, flushing every " << g_flushMs << "ms and rotating every " << g_perFile << " records" << std::endl << std::endl;
+	std::cout << std::left << std::setw(8) << "Buffer" << std::setw(6) << "Level" << std::setw(6) << "Fsync" << std::setw(6) << "Drop" << std::right
+		<< std::setw(10) << "Msg/s" << std::setw(9) << "RawMB/s" << std::setw(9) << "DiskMB/s" << std::setw(7) << "Ratio"
+		<< std::setw(20) << "Write us p50/99/max" << std::setw(22) << "Flush ms p50/99/max" << std::setw(22) << "Rotate ms p50/99/max"
+		<< std::setw(11) << "Behind ms" << std::setw(18) << "Cache KB peak/end" << std::endl;
+
+	for (const Config& c : configs)
+	{
+		boost::system::error_code ec;
+		BF::remove_all(dir, ec);
+		BF::create_directories(dir, ec);
+		if (ec)
+		{
+			std::cerr << "Cannot create " << dir << ": " << ec.message() << std::endl;
+			return 1;
+		}
+
+		Result r;
+		run(c, lines, loggerConfig(dir), r);
+
+		double achieved = r.records / r.seconds;
+		double rawMBps = r.raw / r.seconds / 1e6;
+		double diskMBps = r.compressed / r.seconds / 1e6;
+		double ratio = r.compressed ? double(r.raw) / r.compressed : 0.0;
+		std::ostringstream cache;
+		cache << r.cachePeak / 1024 << "/" << r.cacheEnd / 1024;
+
+		std::cout << std::left << std::setw(8) << c.buffer << std::setw(6) << c.level << std::setw(6) << (c.fsync ? "yes" : "no")
+			<< std::setw(6) << (c.drop ? "yes" : "no") << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(10) << achieved << std::setw(9) << std::setprecision(2) << rawMBps << std::setw(9) << diskMBps
+			<< std::setw(7) << std::setprecision(1) << ratio
+			<< std::setw(20) << percentiles(r.write, 1) << std::setw(22) << percentiles(r.flush, 1000) << std::setw(22) << percentiles(r.rotate, 1000)
+			<< std::setw(11) << r.behindUs / 1000.0 << std::setw(18) << cache.str() << std::endl;
+
+		if (csv.is_open())
+		{
+			Histogram::Snapshot w = r.write.snapshot(), f = r.flush.snapshot(), rt = r.rotate.snapshot();
+			csv << c.buffer << "," << c.level << "," << c.fsync << "," << c.drop << "," << g_rate << "," << achieved << ","
+				<< rawMBps << "," << diskMBps << "," << ratio << ","
+				<< w.percentile(0.5) << "," << w.percentile(0.99) << "," << w.max << ","
+				<< f.percentile(0.5) << "," << f.percentile(0.99) << "," << f.max << ","
+				<< rt.percentile(0.5) << "," << rt.percentile(0.99) << "," << rt.max << ","
+				<< r.behindUs << "," << r.cachePeak / 1024 << "," << r.cacheEnd / 1024 << std::endl;
+		}
+	}
+
+	boost::system::error_code ec;
+	BF::remove_all(dir, ec);
+	return 0;
+}
+
+bool parseCmdLine(int argc, char *argv[])
+{
+	std::map<char, std::string*> strings{ {'w', &g_work}, {'T', &g_trace}, {'o', &g_csv},
+		{'B', &g_buffers}, {'L', &g_levels}, {'F', &g_fsyncs}, {'C', &g_drops} };
+	std::map<char, uint32_t*> numbers{ {'r', &g_rate}, {'z', &g_size}, {'D', &g_seconds}, {'n', &g_perFile},
+		{'f', &g_flushMs}, {'k', &g_keep}, {'K', &g_topK} };
+
+	for (int x = 1; x < argc; ++x)
+	{
+		if (argv[x][0] != '-' || strlen(argv[x]) != 2)
+		{
+			std::cout << "Invalid command line parameters" << std::endl;
+			usage();
+			return false;
+		}
+
+		char opt = argv[x][1];
+		if (opt == 'h')
+		{
+			usage();
+			return false;
+		}
+		if (++x >= argc || (!strings.count(opt) && !numbers.count(opt)))
+		{
+			std::cout << "Invalid command line parameters" << std::endl;
+			usage();
+			return false;
+		}
+
+		if (strings.count(opt))
+			*strings[opt] = argv[x];
+		else
+			*numbers[opt] = uint32_t(strtoul(argv[x], nullptr, 10));
+	}
+
+	if (g_work.empty() || !g_seconds || !g_perFile || !g_flushMs || !g_keep
+		|| parseList(g_buffers).empty() || parseList(g_levels).empty() || parseList(g_fsyncs).empty() || parseList(g_drops).empty())
+	{
+		usage();
+		return false;
+	}
+
+	return true;
+}
+
+void usage()
+{
+	using namespace std;
+	cout << "storagebench - Measure record file writing, flushing and rotation on a medium" << endl;
+	cout << "Usage: storagebench [OPTIONS]" << endl;
+	cout << "Options:" << endl;
+	cout << "\t-h - help. Print this message and exit" << endl;
+	cout << "\t-w dir - directory on the medium under test. Files go in <dir>/storagebench, removed after. Default /tmp" << endl;
+	cout << "\t-r msg/s - write rate, 0 for as fast as possible. Default 2000" << endl;
+	cout << "\t-z bytes - synthetic payload size. Default 256" << endl;
+	cout << "\t-T file.rec.gz - write the records of a captured file instead of synthetic ones" << endl;
+	cout << "\t-D seconds - run time per configuration. Default 10" << endl;
+	cout << "\t-f ms - flush interval, as Flush/@IntervalS. Default 1000" << endl;
+	cout << "\t-n count - records per file, as NewFile/@Count. Default 100000" << endl;
+	cout << "\t-k count - files kept, as MaxFileCount. Default 10" << endl;
+	cout << "\t-K count - subjects tracked for each file's TOP trailer, as TopK/@Capacity. 0 for no TopK. Default 1000" << endl;
+	cout << "\t-B list - zlib buffer sizes to try, as Storage/@BufferBytes. Default 8192,65536" << endl;
+	cout << "\t-L list - compression levels to try, as Storage/@Level. Default 1,6" << endl;
+	cout << "\t-F list - fsync settings to try, 0 or 1, as Storage/@Fsync. Default 0,1" << endl;
+	cout << "\t-C list - cache drop settings to try, 0 or 1, as Storage/@DropCache. Default 0" << endl;
+	cout << "\t-o file - also write the results as CSV" << endl;
+	cout << endl;
+	cout << "Every combination of -B, -L, -F and -C is run in turn. Lists are comma separated." << endl;
+	cout << "Write time is per record into zlib; Behind is how late the writer fell against -r;" << endl;
+	cout << "Cache is the page cache held by the record files, sampled every second." << endl;
+}
@@ -0,0 +1,497 @@
+#include "Logging/Log.h"
+#include "Logger/configuration-pimpl.hxx"
+#include "Logger/Destination.h"
+#include "Logger/Outbox.h"
+#include "Logger/SftpSession.h"
+#include "Logger/Shaper.h"
+#include "Logger/TokenBucket.h"
+#include "Logger/Uploader.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock bclock;
+
+void usage();
+bool parseCmdLine(int argc, char *argv[]);
+
+std::string g_host("127.0.0.1");
+uint16_t g_port{2222};
+std::string g_user(getenv("USER") ? getenv("USER") : "");
+std::string g_password;
+std::string g_keyfile;
+std::string g_remote("/tmp/uploadbench/remote");
+std::string g_work("/tmp/uploadbench/local");
+
+// Left in the -w and -r directories, so a later run knows it may empty them
+const char* WORK_MARKER = ".uploadbench";
+uint32_t g_files{20};
+uint32_t g_sizeKB{1024};
+uint32_t g_concurrency{4};
+uint32_t g_batch{0};
+uint32_t g_runs{3};
+uint32_t g_handshakes{5};
+uint32_t g_delayMs{0};
+uint32_t g_rateBps{0};
+
+Logging::LogFile logfile;
+
+// Forwards loopback connections to the server, holding every chunk back by
+// a fixed delay in each direction and optionally limiting the rate, to stand
+// in for a slow link when netem is not available
+class DelayProxy
+{
+public:
+	DelayProxy(uint16_t target, std::chrono::milliseconds delay, double rateBps)
+		: m_target(target), m_delay(delay), m_rate(rateBps)
+	{
+		m_listen = ::socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in sin{};
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(sin);
+		if (bind(m_listen, (sockaddr*)&sin, len) || listen(m_listen, 8) || getsockname(m_listen, (sockaddr*)&sin, &len))
+			throw std::runtime_error("Unable to start delay proxy");
+		m_port = ntohs(sin.sin_port);
+		m_accept = std::thread([this]() { accept(); });
+	}
+
+	~DelayProxy()
+	{
+		shutdown(m_listen, SHUT_RDWR);
+		::close(m_listen);
+		m_accept.join();
+		for (std::thread& t : m_pumps)
+			t.join();
+	}
+
+	uint16_t port() const { return m_port; }
+
+private:
+	struct Chunk
+	{
+		bclock::time_point due;
+		std::string data;
+	};
+
+	struct Pipe
+	{
+		std::mutex lk;
+		std::condition_variable cv;
+		std::deque<Chunk> q;
+		bool eof{false};
+	};
+
+	void accept()
+	{
+		for (;;)
+		{
+			int client = ::accept(m_listen, nullptr, nullptr);
+			if (client < 0)
+				return;
+
+			int server = ::socket(AF_INET, SOCK_STREAM, 0);
+			sockaddr_in sin{};
+			sin.sin_family = AF_INET;
+			sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			sin.sin_port = htons(m_target);
+			if (::connect(server, (sockaddr*)&sin, sizeof(sin)))
+			{
+				::close(client);
+				::close(server);
+				continue;
+			}
+
+			int one = 1;
+			setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+			// Each direction owns one end for reading and the other for writing.
+			// The writer closes its end once both directions are finished
+			auto up = std::make_shared<Pipe>();
+			auto down = std::make_shared<Pipe>();
+			auto fds = std::make_shared<std::pair<int, int>>(client, server);
+			auto closer = std::shared_ptr<void>(nullptr, [fds](void*) { ::close(fds->first); ::close(fds->second); });
+
+			std::lock_guard<std::mutex> s(m_pumpsLk);
+			m_pumps.emplace_back([this, client, up, closer]() { read(client, *up); });
+			m_pumps.emplace_back([this, server, up, closer]() { write(server, *up); });
+			m_pumps.emplace_back([this, server, down, closer]() { read(server, *down); });
+			m_pumps.emplace_back([this, client, down, closer]() { write(client, *down); });
+		}
+	}
+
+	void read(int fd, Pipe& p)
+	{
+		std::vector<char> buff(64 * 1024);
+		for (;;)
+		{
+			ssize_t n = ::recv(fd, buff.data(), buff.size(), 0);
+			std::lock_guard<std::mutex> s(p.lk);
+			if (n <= 0)
+			{
+				p.eof = true;
+				p.cv.notify_one();
+				return;
+			}
+			p.q.push_back(Chunk{ bclock::now() + m_delay, std::string(buff.data(), size_t(n)) });
+			p.cv.notify_one();
+		}
+	}
+
+	void write(int fd, Pipe& p)
+	{
+		TokenBucket bucket(m_rate, std::max(m_rate / 10, 16384.0));
+		for (;;)
+		{
+			Chunk c;
+			{
+				std::unique_lock<std::mutex> s(p.lk);
+				p.cv.wait(s, [&p]() { return !p.q.empty() || p.eof; });
+				if (p.q.empty())
+				{
+					shutdown(fd, SHUT_WR);
+					return;
+				}
+				c = std::move(p.q.front());
+				p.q.pop_front();
+			}
+
+			std::this_thread::sleep_until(c.due);
+			for (size_t off = 0; off < c.data.size();)
+			{
+				size_t n = std::min<size_t>(c.data.size() - off, 16384);
+				std::this_thread::sleep_for(bucket.wait(double(n)));
+				bucket.take(double(n));
+
+				ssize_t w = ::send(fd, c.data.data() + off, n, MSG_NOSIGNAL);
+				if (w <= 0)
+					return;
+				off += size_t(w);
+			}
+		}
+	}
+
+	uint16_t m_target;
+	uint16_t m_port{0};
+	std::chrono::milliseconds m_delay;
+	double m_rate;
+	int m_listen{-1};
+	std::thread m_accept;
+	std::mutex m_pumpsLk;
+	std::vector<std::thread> m_pumps;
+};
+
+// Collects the Uploader's status reports for one run
+struct RunStatus
+{
+	std::mutex lk;
+	std::condition_variable cv;
+	std::string state;
+	std::string error;
+	std::map<std::string, bclock::time_point> started;
+	std::vector<double> latencyMs;
+
+	static std::string attr(const std::string& xml, const std::string& name)
+	{
+		std::string key = " " + name + "=\"";
+		size_t p = xml.find(key);
+		if (p == std::string::npos)
+			return std::string();
+		p += key.size();
+		return xml.substr(p, xml.find('"', p) - p);
+	}
+
+	void report(const std::string& xml)
+	{
+		std::string st = attr(xml, "State");
+		std::string file = attr(xml, "File");
+
+		std::lock_guard<std::mutex> s(lk);
+		if (st == "file")
+			started[file] = bclock::now();
+		else if (st == "sent" && started.count(file))
+			latencyMs.push_back(std::chrono::duration<double, std::milli>(bclock::now() - started[file]).count());
+		else if (st == "complete" || st == "incomplete" || st == "failed")
+		{
+			state = st;
+			error = attr(xml, "Error");
+			cv.notify_all();
+		}
+	}
+};
+
+double percentile(std::vector<double> v, double p)
+{
+	if (v.empty())
+		return 0.0;
+	std::sort(v.begin(), v.end());
+	return v[std::min(v.size() - 1, size_t(p * v.size()))];
+}
+
+std::string config()
+{
+	std::stringstream strm;
+	strm << "<Logger>"
+		<< "<LogPath>" << g_work << "</LogPath>"
+		<< "<FileNameRoot>bench</FileNameRoot>"
+		<< "<MaxFileCount>" << g_files * 2 + 10 << "</MaxFileCount>"
+		<< "<FtpUpload Host=\"" << g_host << "\" Port=\"" << g_port << "\" path=\"" << g_remote << "\""
+		<< " username=\"" << g_user << "\"";
+	if (!g_password.empty())
+		strm << " password=\"" << g_password << "\"";
+	if (!g_keyfile.empty())
+		strm << " keyfile=\"" << g_keyfile << "\"";
+	strm << " Concurrency=\"" << g_concurrency << "\" BatchFiles=\"" << g_batch << "\" KeepaliveS=\"0\">"
+		<< "<Event>Bench.Upload</Event>"
+		<< "</FtpUpload>"
+		<< "</Logger>";
+	return strm.str();
+}
+
+// Incompressible, like the already gzipped record files the outbox holds
+uint64_t makeFiles(uint32_t run)
+{
+	std::mt19937_64 rng(run);
+	std::vector<uint64_t> buff(g_sizeKB * 1024 / sizeof(uint64_t) + 1);
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < g_files; ++i)
+	{
+		for (uint64_t& w : buff)
+			w = rng();
+
+		std::stringstream name;
+		name << g_work << "/bench_" << run << "_" << std::setw(4) << std::setfill('0') << i << ".rec.gz";
+		std::ofstream out(name.str(), std::ios::binary);
+		out.write(reinterpret_cast<const char*>(buff.data()), std::streamsize(g_sizeKB) * 1024);
+		total += uint64_t(g_sizeKB) * 1024;
+	}
+	return total;
+}
+
+// Empty dir for a run. Only a directory this bench made, or an empty one,
+// is emptied
+bool resetDir(const std::string& dir, const char* option)
+{
+	boost::system::error_code ec;
+	if (BF::exists(dir) && !BF::is_empty(dir, ec) && !BF::exists(BF::path(dir) / WORK_MARKER))
+	{
+		std::cout << dir << " is not empty and was not made by uploadbench. Give " << option << " an empty or new directory" << std::endl;
+		return false;
+	}
+
+	BF::remove_all(dir);
+	BF::create_directories(dir);
+	std::ofstream((BF::path(dir) / WORK_MARKER).string());
+	return true;
+}
+
+uint64_t remoteBytes()
+{
+	uint64_t total = 0;
+	boost::system::error_code ec;
+	for (BF::directory_iterator it(g_remote, ec), end; !ec && it != end; ++it)
+		total += BF::file_size(it->path(), ec);
+	return total;
+}
+
+int main(int argc, char* argv[])
+{
+	if (!parseCmdLine(argc, argv))
+		return -1;
+
+	if (!resetDir(g_work, "-w") || !resetDir(g_remote, "-r"))
+		return 1;
+	logfile.open((BF::path(g_work).parent_path() / "uploadbench.log").string());
+
+	std::unique_ptr<DelayProxy> proxy;
+	if (g_delayMs || g_rateBps)
+	{
+		proxy.reset(new DelayProxy(g_port, std::chrono::milliseconds(g_delayMs), g_rateBps));
+		std::cout << "Delay proxy on port " << proxy->port() << ": " << g_delayMs << "ms each way";
+		if (g_rateBps)
+			std::cout << ", " << g_rateBps << " B/s";
+		std::cout << std::endl;
+		g_host = "127.0.0.1";
+		g_port = proxy->port();
+	}
+
+	loggercfg::Logger cfg;
+	{
+		loggercfg::Logger_paggr s;
+		xml_schema::document_pimpl d(s.root_parser(), s.root_name());
+		std::istringstream strm(config());
+		s.pre();
+		try
+		{
+			d.parse(strm);
+		}
+		catch (xml_schema::parser_exception& ex)
+		{
+			std::cout << "Config error: " << ex.text() << " at " << ex.line() << ":" << ex.column() << std::endl;
+			return 1;
+		}
+		std::unique_ptr<loggercfg::Logger>{s.post()}->_copy(cfg);
+	}
+	Destination dest = Destination::fromConfig(cfg.FtpUpload()).front();
+
+	// Connection set-up cost on its own, with a fresh session each time
+	std::vector<double> connectMs, tcpMs, handshakeMs, authMs;
+	for (uint32_t i = 0; i < g_handshakes; ++i)
+	{
+		SftpSession session(logfile, dest, cfg.FtpUpload());
+		if (!session.sftp())
+		{
+			std::cout << "Unable to connect: " << session.lastError() << std::endl;
+			return 1;
+		}
+		connectMs.push_back(double(session.connectTime().count()));
+		tcpMs.push_back(double(session.tcpTime().count()));
+		handshakeMs.push_back(double(session.handshakeTime().count()));
+		authMs.push_back(double((session.connectTime() - session.tcpTime() - session.handshakeTime()).count()));
+	}
+	if (!connectMs.empty())
+	{
+		std::cout << "Connect over " << connectMs.size() << ": p50 " << percentile(connectMs, 0.5)
+			<< "ms, max " << percentile(connectMs, 1.0) << "ms" << std::endl;
+		std::cout << "  tcp p50 " << percentile(tcpMs, 0.5) << "ms, handshake p50 " << percentile(handshakeMs, 0.5)
+			<< "ms, auth+sftp p50 " << percentile(authMs, 0.5) << "ms" << std::endl;
+	}
+
+	std::cout << "Uploading " << g_files << " x " << g_sizeKB << " KB, concurrency " << g_concurrency
+		<< (g_batch > 1 ? ", batches of " + std::to_string(g_batch) : std::string(", one file at a time")) << std::endl;
+
+	int ret = 0;
+	std::vector<double> rates;
+	for (uint32_t run = 0; run < g_runs; ++run)
+	{
+		if (run && !resetDir(g_remote, "-r"))
+			return 1;
+		uint64_t bytes = makeFiles(run);
+
+		// The outbox adopts the files as a restarted logger would
+		Outbox outbox(logfile, cfg);
+		Shaper shaper(logfile);
+		shaper.configure(cfg.FtpUpload());
+		RunStatus status;
+		auto start = bclock::now();
+		{
+			Uploader up(logfile, cfg, dest, outbox, shaper, nullptr, [&status](const std::string& s) { status.report(s); });
+			up.setPrefix("");
+			up.request();
+
+			std::unique_lock<std::mutex> s(status.lk);
+			if (!status.cv.wait_for(s, std::chrono::minutes(10), [&status]() { return !status.state.empty(); }))
+				status.state = "timeout";
+		}
+		double secs = std::chrono::duration<double>(bclock::now() - start).count();
+
+		double mbps = bytes / secs / 1e6;
+		uint64_t landed = remoteBytes();
+		std::cout << "Run " << run + 1 << ": " << status.state << " in " << std::fixed << std::setprecision(3) << secs << "s, "
+			<< std::setprecision(2) << mbps << " MB/s, file latency p50 " << percentile(status.latencyMs, 0.5)
+			<< "ms p95 " << percentile(status.latencyMs, 0.95) << "ms max " << percentile(status.latencyMs, 1.0) << "ms, "
+			<< landed << " bytes on the server" << std::endl;
+
+		if (status.state != "complete" || landed < bytes || outbox.size())
+		{
+			std::cout << "Upload did not complete" << (status.error.empty() ? std::string() : ": " + status.error) << std::endl;
+			ret = 1;
+			break;
+		}
+		rates.push_back(mbps);
+	}
+
+	if (!rates.empty())
+		std::cout << "Throughput over " << rates.size() << " runs: median " << percentile(rates, 0.5) << " MB/s, best "
+			<< percentile(rates, 1.0) << " MB/s" << std::endl;
+
+	return ret;
+}
+
+bool parseCmdLine(int argc, char *argv[])
+{
+	std::map<char, std::string*> strings{ {'H', &g_host}, {'u', &g_user}, {'p', &g_password}, {'k', &g_keyfile}, {'r', &g_remote}, {'w', &g_work} };
+	std::map<char, uint32_t*> numbers{ {'n', &g_files}, {'s', &g_sizeKB}, {'c', &g_concurrency}, {'b', &g_batch}, {'R', &g_runs},
+		{'C', &g_handshakes}, {'d', &g_delayMs}, {'B', &g_rateBps} };
+
+	for (int x = 1; x < argc; ++x)
+	{
+		if (argv[x][0] != '-' || strlen(argv[x]) != 2)
+		{
+			std::cout << "Invalid command line parameters" << std::endl;
+			usage();
+			return false;
+		}
+
+		char opt = argv[x][1];
+		if (opt == 'h')
+		{
+			usage();
+			return false;
+		}
+		if (++x >= argc || (!strings.count(opt) && !numbers.count(opt) && opt != 'P'))
+		{
+			std::cout << "Invalid command line parameters" << std::endl;
+			usage();
+			return false;
+		}
+
+		if (strings.count(opt))
+			*strings[opt] = argv[x];
+		else if (opt == 'P')
+			g_port = uint16_t(strtoul(argv[x], nullptr, 10));
+		else
+			*numbers[opt] = uint32_t(strtoul(argv[x], nullptr, 10));
+	}
+
+	if (g_work.empty() || g_remote.empty() || !g_files || !g_sizeKB)
+	{
+		usage();
+		return false;
+	}
+
+	return true;
+}
+
+void usage()
+{
+	using namespace std;
+	cout << "uploadbench - Measure the SFTP upload path against a local server" << endl;
+	cout << "Usage: uploadbench [OPTIONS]" << endl;
+	cout << "Start a server first with sftpd.sh, which prints a matching command line." << endl;
+	cout << "Options:" << endl;
+	cout << "\t-h - help. Print this message and exit" << endl;
+	cout << "\t-H host, -P port - server. Default 127.0.0.1:2222" << endl;
+	cout << "\t-u user, -p password, -k keyfile - credentials. A key's passphrase goes in -p" << endl;
+	cout << "\t-r dir - directory the server writes to. Must be new, empty or made by uploadbench; emptied before each run. Default /tmp/uploadbench/remote" << endl;
+	cout << "\t-w dir - local LogPath. Must be new, empty or made by uploadbench; emptied first. Default /tmp/uploadbench/local" << endl;
+	cout << "\t-n count, -s KB - files per run and their size. Default 20 x 1024 KB" << endl;
+	cout << "\t-c count - FtpUpload/@Concurrency. Default 4" << endl;
+	cout << "\t-b count - FtpUpload/@BatchFiles. Default 0, one file at a time" << endl;
+	cout << "\t-R count - runs. Default 3" << endl;
+	cout << "\t-C count - separate connects timed before the runs. Default 5" << endl;
+	cout << "\t-d ms, -B bytes/s - route through an in-process proxy adding this delay each way and rate limit" << endl;
+	cout << endl;
+	cout << "Per-file latency is from the upload of a file starting to the server confirming all of it." << endl;
+}
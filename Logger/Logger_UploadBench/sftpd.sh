@@ -0,0 +1,61 @@
+#!/bin/sh
+# Runs a throwaway sshd on loopback for uploadbench. It runs as the calling
+# user with key authentication only and the built in sftp server, so no root
+# or system configuration is needed. Everything lives under the state dir.
+#
+# Usage: sftpd.sh [-p port] [-s statedir] [-d netem delay ms]
+#
+# -d shapes the loopback device with netem for the life of the server, which
+# needs root and affects all loopback traffic. Without root use uploadbench -d.
+
+PORT=2222
+STATE=/tmp/uploadbench/sshd
+DELAY=
+
+while getopts "p:s:d:h" opt; do
+	case $opt in
+	p) PORT=$OPTARG ;;
+	s) STATE=$OPTARG ;;
+	d) DELAY=$OPTARG ;;
+	*) sed -n '2,9p' "$0"; exit 1 ;;
+	esac
+done
+
+SSHD=$(command -v sshd || echo /usr/sbin/sshd)
+if [ ! -x "$SSHD" ]; then
+	echo "sshd not found. Install openssh-server" >&2
+	exit 1
+fi
+
+mkdir -p "$STATE"
+cd "$STATE" || exit 1
+
+# PEM keys so that libssh2 builds using older OpenSSL can read them
+[ -f host_rsa_key ] || ssh-keygen -q -t rsa -b 2048 -m PEM -N '' -f host_rsa_key
+[ -f host_ecdsa_key ] || ssh-keygen -q -t ecdsa -b 256 -m PEM -N '' -f host_ecdsa_key
+[ -f client_key ] || ssh-keygen -q -t rsa -b 2048 -m PEM -N '' -f client_key
+cp client_key.pub authorized_keys
+
+cat > sshd_config <<EOF
+Port $PORT
+ListenAddress 127.0.0.1
+HostKey $STATE/host_rsa_key
+HostKey $STATE/host_ecdsa_key
+PidFile $STATE/sshd.pid
+AuthorizedKeysFile $STATE/authorized_keys
+PubkeyAuthentication yes
+PasswordAuthentication no
+KbdInteractiveAuthentication no
+StrictModes no
+Subsystem sftp internal-sftp
+EOF
+
+if [ -n "$DELAY" ]; then
+	tc qdisc add dev lo root netem delay "${DELAY}ms" || exit 1
+	trap 'tc qdisc del dev lo root netem' EXIT
+	trap 'exit 0' INT TERM
+fi
+
+echo "Listening on 127.0.0.1:$PORT. Run:"
+echo "  uploadbench -P $PORT -u $(id -un) -k $STATE/client_key"
+"$SSHD" -D -e -f "$STATE/sshd_config"